@@ -4,10 +4,14 @@
 #include "Thread.h"
 #include "AlxTime.h"
 #include "DataStream.h"
+#include "AudioVad.h"
+#include "AudioBus.h"
+#include "AudioBackend.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
 #include <alsa/asoundlib.h>
 
 
@@ -169,8 +173,17 @@ WavFile WavFile_Read(char* Path,int frame_size){
         if (strncmp(subchunk.subchunkId, "fmt ", 4) == 0) {
             a = fread(&wf.fmtChunk, sizeof(WavFmtChunk), 1, file);
             wf.foundFmt = 1;
-            if (subchunk.subchunkSize > sizeof(WavFmtChunk)) {
-                fseek(file, subchunk.subchunkSize - sizeof(WavFmtChunk), SEEK_CUR);
+            long rest = (long)subchunk.subchunkSize - (long)sizeof(WavFmtChunk);
+            // WAVE_FORMAT_EXTENSIBLE: the real format (1 = pcm, 3 = float) starts the SubFormat guid,
+            // so the file is handled and written back like a plain pcm/float one
+            if (wf.fmtChunk.audioFormat == 0xFFFE && rest >= 24) {
+                uint16_t ext[5];
+                a = fread(ext, sizeof(uint16_t), 5, file);
+                wf.fmtChunk.audioFormat = ext[4];
+                rest -= sizeof(ext);
+            }
+            if (rest > 0) {
+                fseek(file, rest, SEEK_CUR);
             }
         } else if (strncmp(subchunk.subchunkId, "data", 4) == 0) {
             wf.dataSize = subchunk.subchunkSize;
@@ -197,6 +210,42 @@ WavFile WavFile_Read(char* Path,int frame_size){
 
     return wf;
 }
+size_t WavFile_Frames(WavFile* wf){
+    return wf->fmtChunk.blockAlign ? wf->dataSize / wf->fmtChunk.blockAlign : 0;
+}
+// sample as float in [-1,1), works for 8/16/24/32 bit pcm and 32 bit float
+float WavFile_Get(WavFile* wf,size_t frame,int channel){
+    int bytes = wf->fmtChunk.bitsPerSample / 8;
+    unsigned char* s = (unsigned char*)wf->buffer + frame * wf->fmtChunk.blockAlign + channel * bytes;
+    if(wf->fmtChunk.audioFormat==3){
+        float f;
+        memcpy(&f,s,sizeof(float));
+        return f;
+    }
+    switch(bytes){
+        case 1: return ((int)s[0] - 128) / 128.0f;
+        case 2: return (int16_t)(s[0] | (s[1] << 8)) / 32768.0f;
+        case 3: return (int32_t)(((uint32_t)s[0] << 8) | ((uint32_t)s[1] << 16) | ((uint32_t)s[2] << 24)) / 2147483648.0f;
+        case 4: return (int32_t)((uint32_t)s[0] | ((uint32_t)s[1] << 8) | ((uint32_t)s[2] << 16) | ((uint32_t)s[3] << 24)) / 2147483648.0f;
+    }
+    return 0.0f;
+}
+void WavFile_Set(WavFile* wf,size_t frame,int channel,float value){
+    int bytes = wf->fmtChunk.bitsPerSample / 8;
+    unsigned char* s = (unsigned char*)wf->buffer + frame * wf->fmtChunk.blockAlign + channel * bytes;
+    if(wf->fmtChunk.audioFormat==3){
+        memcpy(s,&value,sizeof(float));
+        return;
+    }
+    if(value > 1.0f) value = 1.0f;
+    if(value < -1.0f) value = -1.0f;
+
+    double scale = (double)(1ULL << (bytes * 8 - 1));
+    long long v = llround(value * scale);
+    if(v > scale - 1.0) v = (long long)scale - 1;
+    if(bytes==1) v += 128;
+    for(int i = 0;i<bytes;i++) s[i] = (v >> (i * 8)) & 0xFF;
+}
 void WavFile_Free(WavFile* wf){
     if(wf->buffer) free(wf->buffer);
     memset(wf,0,sizeof(wf));
@@ -206,11 +255,11 @@ void WavFile_Free(WavFile* wf){
 typedef short AudioSample;
 
 typedef struct OAudio{
-    snd_pcm_t *pcm_handle;
-    snd_pcm_hw_params_t *params;
+    void *pcm_handle;
+    AudioBackend backend;
     int err;
     int numChannels;
-    int rate;
+    unsigned int rate;
     int bits;
     snd_pcm_uframes_t frames;
     size_t bytes_per_frame;
@@ -221,7 +270,7 @@ typedef struct OAudio{
 OAudio OAudio_Null(){
     OAudio a;
     a.pcm_handle = NULL;
-    a.params = NULL;
+    memset(&a.backend,0,sizeof(AudioBackend));
     a.err = 0;
     a.numChannels = 0;
     a.rate = 0;
@@ -232,62 +281,56 @@ OAudio OAudio_Null(){
     a.buffer_size = 0;
     return a;
 }
-OAudio OAudio_New(enum _snd_pcm_format format,int bits,int frames,unsigned int channels,unsigned int rate){
+// plays through any backend, e.g. AudioBackend_Memory to render faster than real-time
+OAudio OAudio_NewOn(AudioBackend backend,enum _snd_pcm_format format,int bits,int frames,unsigned int channels,unsigned int rate){
     OAudio a = OAudio_Null();
 
-    if ((a.err = snd_pcm_open(&a.pcm_handle, "default", SND_PCM_STREAM_PLAYBACK, 0)) < 0) {
-        fprintf(stderr, "[OAudio]: Couldn't open PCM-Device: %s\n", snd_strerror(a.err));
-        return OAudio_Null();
-    }
-
-    snd_pcm_hw_params_alloca(&a.params);
-    if ((a.err = snd_pcm_hw_params_any(a.pcm_handle, a.params)) < 0) {
+    AudioConfig cfg;
+    cfg.device = NULL;
+    cfg.stream = AUDIOBACKEND_PLAYBACK;
+    cfg.format = format;
+    cfg.bits = bits;
+    cfg.channels = channels;
+    cfg.rate = rate;
+    cfg.frames = frames;
+    cfg.latency = 0;
+
+    a.pcm_handle = backend.open(&backend,&cfg,&a.err);
+    if (!a.pcm_handle) {
         fprintf(stderr, "[OAudio]: Couldn't open PCM-Device: %s\n", snd_strerror(a.err));
         return OAudio_Null();
     }
 
+    a.backend = backend;
     a.bits = bits;
     a.numChannels = channels;
-
-    if ((a.err = snd_pcm_hw_params_set_access(a.pcm_handle, a.params, SND_PCM_ACCESS_RW_INTERLEAVED)) < 0) {
-        fprintf(stderr, "[OAudio]: Couldn't open PCM-Device: %s\n", snd_strerror(a.err));
-        return OAudio_Null();
-    }
-    if ((a.err = snd_pcm_hw_params_set_format(a.pcm_handle, a.params, format)) < 0) {
-        fprintf(stderr, "[OAudio]: Couldn't open PCM-Device: %s\n", snd_strerror(a.err));
-        return OAudio_Null();
-    }
-    if ((a.err = snd_pcm_hw_params_set_channels(a.pcm_handle, a.params, a.numChannels)) < 0) {
-        fprintf(stderr, "[OAudio]: Couldn't open PCM-Device: %s\n", snd_strerror(a.err));
-        return OAudio_Null();
-    }
-
-    a.rate = rate;
-    if ((a.err = snd_pcm_hw_params_set_rate_near(a.pcm_handle, a.params, &a.rate, 0)) < 0) {
-        fprintf(stderr, "[OAudio]: Couldn't open PCM-Device: %s\n", snd_strerror(a.err));
-        return OAudio_Null();
-    }
-
-    if ((a.err = snd_pcm_hw_params_set_periods(a.pcm_handle, a.params, 4, 0)) < 0) {
-        fprintf(stderr, "[OAudio]: Couldn't open PCM-Device: %s\n", snd_strerror(a.err));
-        return OAudio_Null();
-    }
-    
+    a.rate = cfg.rate;
     a.frames = frames;
+    a.bytes_per_frame = channels * (bits / 8);
     a.buffer_size = frames * channels * (bits / 8);
-    if ((a.err = snd_pcm_hw_params_set_buffer_size_near(a.pcm_handle, a.params, &a.buffer_size)) < 0) {
-        fprintf(stderr, "[OAudio]: Couldn't open PCM-Device: %s\n", snd_strerror(a.err));
-        return OAudio_Null();
-    }
-
-    if ((a.err = snd_pcm_hw_params(a.pcm_handle, a.params)) < 0) {
-        fprintf(stderr, "Kann Hardware-Parameter nicht setzen: %s\n", snd_strerror(a.err));
-        snd_pcm_close(a.pcm_handle);
-        return OAudio_Null();
-    }
-    
     return a;
 }
+OAudio OAudio_New(enum _snd_pcm_format format,int bits,int frames,unsigned int channels,unsigned int rate){
+    return OAudio_NewOn(AudioBackend_Alsa(),format,bits,frames,channels,rate);
+}
+int OAudio_WriteFrames(OAudio* a,char* buffer,size_t frames){
+    size_t written = 0;
+    while(written < frames){
+        a->err = a->backend.writei(a->pcm_handle, buffer + written * a->bytes_per_frame, frames - written);
+        if (a->err < 0) {
+            if (a->err == -EPIPE) {
+                printf("[OAudio]: Write -> bufferoverflow, reseting...\n");
+                a->backend.prepare(a->pcm_handle);
+            } else {
+                printf("[OAudio]: Write -> error during write: %s\n", snd_strerror(a->err));
+                return a->err;
+            }
+        } else {
+            written += a->err;
+        }
+    }
+    return written;
+}
 void OAudio_Write(OAudio* a,char* buffer,int dataSize){
     a->bytes_per_frame = a->numChannels * (a->bits / 8);
     
@@ -299,18 +342,7 @@ void OAudio_Write(OAudio* a,char* buffer,int dataSize){
 
     for (size_t i = 0; i < a->total_frames; i += a->frames) {
         size_t frames_to_write = (i + a->frames > a->total_frames) ? a->total_frames - i : a->frames;
-        a->err = snd_pcm_writei(a->pcm_handle, buffer + i * a->bytes_per_frame, frames_to_write);
-        if (a->err < 0) {
-            if (a->err == -EPIPE) {
-                printf("[OAudio]: Write -> bufferoverflow, reseting...\n");
-                snd_pcm_prepare(a->pcm_handle);
-            } else {
-                printf("[OAudio]: Write -> error during write: %s\n", snd_strerror(a->err));
-                break;
-            }
-        } else if ((size_t)a->err != frames_to_write) {
-            printf("[OAudio]: Write -> short write: %d of %ld frames\n", a->err, frames_to_write);
-        }
+        if(OAudio_WriteFrames(a,buffer + i * a->bytes_per_frame,frames_to_write) < 0) break;
     }
 }
 void OAudio_Adapt(OAudio* a,WavFile* wf){
@@ -327,14 +359,66 @@ void OAudio_Play(OAudio* a,WavFile* wf){
     OAudio_Adapt(a,wf);
     OAudio_Write(a,wf->buffer,wf->dataSize);
 }
+// converts any 8/16/24/32 bit pcm or 32 bit float wav to the format of the output, so it can be mixed or spliced into one stream
+WavFile OAudio_Decode(OAudio* a,char* Path){
+    WavFile wf = WavFile_Read(Path,a->frames);
+    if(!wf.buffer) return wf;
+
+    int in_ch = wf.fmtChunk.numChannels;
+    int in_bytes = wf.fmtChunk.bitsPerSample / 8;
+    int out_ch = a->numChannels;
+
+    if(wf.fmtChunk.sampleRate != (uint32_t)a->rate){
+        printf("[OAudio]: Decode -> \"%s\" has %d Hz, output runs at %d Hz!\n",Path,wf.fmtChunk.sampleRate,a->rate);
+    }
+    if(wf.fmtChunk.audioFormat==1 && in_ch == out_ch && wf.fmtChunk.bitsPerSample == a->bits) return wf;
+    if(in_ch==0 || in_bytes==0 || in_bytes>4 || a->bits!=16 ||
+        !(wf.fmtChunk.audioFormat==1 || (wf.fmtChunk.audioFormat==3 && in_bytes==4))){
+        printf("[OAudio]: Decode -> can't convert \"%s\" to the output format!\n",Path);
+        WavFile_Free(&wf);
+        return WavFile_Null();
+    }
+
+    size_t frames = WavFile_Frames(&wf);
+    AudioSample* data = malloc(frames * out_ch * sizeof(AudioSample));
+
+    for(size_t f = 0;f<frames;f++){
+        float in[in_ch];
+        for(int c = 0;c<in_ch;c++) in[c] = WavFile_Get(&wf,f,c);
+        for(int c = 0;c<out_ch;c++){
+            float x = 0.0f;
+            if(out_ch==1){
+                for(int i = 0;i<in_ch;i++) x += in[i];
+                x /= in_ch;
+            }else{
+                x = in[c % in_ch];
+            }
+            long v = lrintf(x * 32768.0f);
+            data[f * out_ch + c] = v > 32767 ? 32767 : (v < -32768 ? -32768 : (AudioSample)v);
+        }
+    }
+
+    free(wf.buffer);
+    wf.buffer = (char*)data;
+    wf.fmtChunk.audioFormat = 1;
+    wf.fmtChunk.numChannels = out_ch;
+    wf.fmtChunk.bitsPerSample = 16;
+    wf.fmtChunk.blockAlign = out_ch * 2;
+    wf.fmtChunk.byteRate = wf.fmtChunk.sampleRate * wf.fmtChunk.blockAlign;
+    wf.dataSize = frames * out_ch * sizeof(AudioSample);
+    return wf;
+}
 void OAudio_Free(OAudio* a){
-    snd_pcm_drain(a->pcm_handle);
-    snd_pcm_close(a->pcm_handle);
+    if(!a->pcm_handle) return;
+    a->backend.drain(a->pcm_handle);
+    a->backend.close(a->pcm_handle);
+    a->pcm_handle = NULL;
 }
 
 
 typedef struct IAudio{
-    snd_pcm_t *pcm_handle;
+    void *pcm_handle;
+    AudioBackend backend;
     Thread thread;
     char running;
     DataStream buffer;
@@ -344,11 +428,14 @@ typedef struct IAudio{
     unsigned int channels;
     unsigned int rate;
     unsigned int latency;
+    AudioVad vad;
+    AudioBus bus;
 } IAudio;
 
 IAudio IAudio_Null(){
     IAudio a;
     a.pcm_handle = NULL;
+    memset(&a.backend,0,sizeof(AudioBackend));
     a.thread = Thread_Null();
     a.running = 0;
     a.buffer = DataStream_Null();
@@ -358,9 +445,12 @@ IAudio IAudio_Null(){
     a.channels = 0;
     a.rate = 0;
     a.latency = 0;
+    a.vad = AudioVad_Null();
+    a.bus = AudioBus_Null();
     return a;
 }
-IAudio IAudio_New(enum _snd_pcm_format format,int bits,int frames_buffer,unsigned int channels,unsigned int rate,unsigned int latency){
+// records from any backend, e.g. AudioBackend_Memory with a source to capture faster than real-time
+IAudio IAudio_NewOn(AudioBackend backend,enum _snd_pcm_format format,int bits,int frames_buffer,unsigned int channels,unsigned int rate,unsigned int latency){
     IAudio a = IAudio_Null();
 
     a.thread = Thread_Null();
@@ -373,31 +463,67 @@ IAudio IAudio_New(enum _snd_pcm_format format,int bits,int frames_buffer,unsigne
     a.rate = rate;
     a.latency = latency;
 
-    snd_pcm_open(&a.pcm_handle, "default", SND_PCM_STREAM_CAPTURE, 0);
-    snd_pcm_set_params(a.pcm_handle,
-                       format,
-                       SND_PCM_ACCESS_RW_INTERLEAVED,
-                       channels,
-                       rate,
-                       1,
-                       latency); // 0.5 Sekunden Latenz
+    AudioConfig cfg;
+    cfg.device = NULL;
+    cfg.stream = AUDIOBACKEND_CAPTURE;
+    cfg.format = format;
+    cfg.bits = bits;
+    cfg.channels = channels;
+    cfg.rate = rate;
+    cfg.frames = frames_buffer;
+    cfg.latency = latency; // 0.5 Sekunden Latenz
+
+    int err = 0;
+    a.backend = backend;
+    a.pcm_handle = backend.open(&backend,&cfg,&err);
+    if (!a.pcm_handle) fprintf(stderr, "[IAudio]: Couldn't open PCM-Device: %s\n", snd_strerror(err));
     
     return a;
 }
+IAudio IAudio_New(enum _snd_pcm_format format,int bits,int frames_buffer,unsigned int channels,unsigned int rate,unsigned int latency){
+    return IAudio_NewOn(AudioBackend_Alsa(),format,bits,frames_buffer,channels,rate,latency);
+}
 void* IAudio_Execute(IAudio* a){
     int frame_size = a->bits / 8 * a->channels;
     int16_t* buffer = malloc(a->frames_buffer * a->channels * sizeof(int16_t));
 
-    Timepoint start = Time_Nano();
-
     while (a->running) {
         int frames_to_read = a->frames_buffer;
-        int err = snd_pcm_readi(a->pcm_handle, buffer, frames_to_read);
+        if(a->bus.header){
+            // publishing: the device reads straight into the shared ring, nothing is stored locally
+            char* slot = AudioBus_Slot(&a->bus);
+            int room = a->bus.header->capacity - (slot - a->bus.ring) / frame_size;
+            int err = a->backend.readi(a->pcm_handle, slot, frames_to_read < room ? frames_to_read : room);
+            if (err == -EPIPE) {
+                a->backend.prepare(a->pcm_handle);
+                continue;
+            }
+            if (err < 0) {
+                if (err != -ENODATA) fprintf(stderr, "Error reading audio: %s\n", snd_strerror(err));
+                break;
+            }
+            AudioBus_Publish(&a->bus,err);
+            continue;
+        }
+
+        int err = a->backend.readi(a->pcm_handle, buffer, frames_to_read);
+        if (err == -EPIPE) {
+            a->backend.prepare(a->pcm_handle);
+            continue;
+        }
         if (err < 0) {
-            fprintf(stderr, "Error reading audio: %s\n", snd_strerror(err));
+            if (err != -ENODATA) fprintf(stderr, "Error reading audio: %s\n", snd_strerror(err));
             break;
         }
-        DataStream_PushCount(&a->buffer,buffer,frame_size * err);
+        if(a->vad.enabled){
+            // device time, so a period that arrives early or late doesn't move the segment
+            Timepoint begin = Time_SecToNano((double)a->vad.frames / a->rate);
+            a->vad.frames += err;
+            Timepoint end = Time_SecToNano((double)a->vad.frames / a->rate);
+            AudioVad_Feed(&a->vad,&a->buffer,buffer,frame_size * err,begin,end);
+        }else{
+            DataStream_PushCount(&a->buffer,buffer,frame_size * err);
+        }
     }
 
     if(buffer) free(buffer);
@@ -422,17 +548,73 @@ void IAudio_Stop(IAudio* a){
         printf("[IAudio]: Stop -> can't stop because it already stopped!\n");
     }
 }
+// only periods with voice activity (plus pre-roll and hangover) get stored, threshold in dBFS
+void IAudio_Gate(IAudio* a,float threshold,int hangover_ms,int preroll_ms){
+    if(a->running){
+        printf("[IAudio]: Gate -> can't change the detector while running!\n");
+        return;
+    }
+    if(a->bits!=16){
+        printf("[IAudio]: Gate -> only 16 bit capture can be gated!\n");
+        return;
+    }
+    int period_ms = a->frames_buffer * 1000 / a->rate;
+    if(period_ms<=0) period_ms = 1;
+
+    AudioVad_Free(&a->vad);
+    a->vad = AudioVad_New(a->frames_buffer * a->channels * sizeof(int16_t),threshold,100,hangover_ms / period_ms,preroll_ms / period_ms);
+}
+// publishes every period into the shared ring /dev/shm/<Name> instead of storing it, see AudioBusReader
+void IAudio_Publish(IAudio* a,char* Name,unsigned int periods){
+    if(a->running){
+        printf("[IAudio]: Publish -> can't change mode while running!\n");
+        return;
+    }
+    AudioBus_Free(&a->bus);
+    if(Name) a->bus = AudioBus_New(Name,a->format,a->rate,a->channels,a->bits,a->frames_buffer,periods);
+}
 void IAudio_Clear(IAudio* a){
     DataStream_Clear(&a->buffer);
+    AudioVad_Clear(&a->vad);
 }
 void IAudio_Write(IAudio* a,char* Path){
     int frame_size = a->bits / 8 * a->channels;
     WavFile wf = WavFile_Move(a->rate,a->bits,a->channels,a->buffer.Memory,a->buffer.size / frame_size,frame_size);
     WavFile_Write(&wf,Path);
 }
+// captures from the samples of a wav file, see AudioBackend_Memory
+void AudioMemory_Load(AudioMemory* m,char* Path,char loop){
+    WavFile wf = WavFile_Read(Path,1);
+    if(!wf.buffer) return;
+    AudioMemory_Source(m,wf.buffer,wf.dataSize,loop);
+    m->owned = 1;
+}
+// writes everything that was played into the memory sink as wav
+void AudioMemory_Write(AudioMemory* m,char* Path){
+    if(m->frame_size==0){
+        printf("[AudioMemory]: Write -> was never opened!\n");
+        return;
+    }
+    WavFile wf = WavFile_Move(m->rate,m->bits,m->channels,m->sink.Memory,m->sink.size / m->frame_size,m->frame_size);
+    WavFile_Write(&wf,Path);
+}
+// writes every gated segment into its own file: <Path>_<index>.wav
+void IAudio_WriteSegments(IAudio* a,char* Path){
+    int frame_size = a->bits / 8 * a->channels;
+    char name[512];
+    for(int i = 0;i<AudioVad_Count(&a->vad);i++){
+        AudioVadSegment* s = ((AudioVadSegment*)a->vad.segments.Memory) + i;
+        snprintf(name,sizeof(name),"%s_%03d.wav",Path,i);
+        WavFile wf = WavFile_Move(a->rate,a->bits,a->channels,(char*)a->buffer.Memory + s->offset,s->size / frame_size,frame_size);
+        WavFile_Write(&wf,name);
+    }
+}
 void IAudio_Free(IAudio* a){
+    AudioBus_Free(&a->bus);
+    AudioVad_Free(&a->vad);
     DataStream_Free(&a->buffer);
-    snd_pcm_close(a->pcm_handle);
+    if(a->pcm_handle) a->backend.close(a->pcm_handle);
+    a->pcm_handle = NULL;
 }
 
 
@@ -0,0 +1,329 @@
+#ifndef AUDIOAGGREGATE_H
+#define AUDIOAGGREGATE_H
+
+#include "Audio.h"
+#include "RingBuffer.h"
+
+#define AUDIOAGGREGATE_PERIODS      64      // periods a device ring can hold before the capture thread drops
+#define AUDIOAGGREGATE_MAX_DRIFT    0.01    // resampling corrects at most 1% of rate difference
+#define AUDIOAGGREGATE_SETTLE       1.0     // seconds of timestamps before the drift estimate is trusted
+
+typedef struct AudioAggregatePeriod{
+    Timepoint time;                 // device clock right after the period arrived
+    unsigned long long position;    // frames the device delivered before this period, dropped ones included
+    unsigned int frames;
+} AudioAggregatePeriod;
+
+struct AudioAggregate;
+
+typedef struct AudioAggregateDevice{
+    char Name[64];
+    void* pcm_handle;
+    AudioBackend backend;
+    Thread thread;
+    struct AudioAggregate* parent;
+    RingBuffer ring;
+    unsigned long long position;
+    unsigned long long dropped;
+    // merge side only
+    Timepoint first;
+    Timepoint last;
+    unsigned long long frames;
+    unsigned long long silence;     // dropped frames that still have to go into the fifo
+    unsigned long long skip;        // frames before the common start that still have to be thrown away
+    double ratio;
+    double phase;
+    float* fifo;
+    int fifo_frames;
+    int fifo_size;
+} AudioAggregateDevice;
+
+// N capture devices merged into one sample aligned interleaved stream, device 0 is the clock master
+typedef struct AudioAggregate{
+    AudioAggregateDevice* devices;
+    int count;
+    Thread merge;
+    char running;
+    DataStream buffer;
+    enum _snd_pcm_format format;
+    int bits;
+    int frames_buffer;
+    unsigned int channels;
+    unsigned int rate;
+    unsigned int latency;
+} AudioAggregate;
+
+void AudioAggregate_Free(AudioAggregate* a);
+
+AudioAggregate AudioAggregate_Null(){
+    AudioAggregate a;
+    a.devices = NULL;
+    a.count = 0;
+    a.merge = Thread_Null();
+    a.running = 0;
+    a.buffer = DataStream_Null();
+    a.format = 0;
+    a.bits = 0;
+    a.frames_buffer = 0;
+    a.channels = 0;
+    a.rate = 0;
+    a.latency = 0;
+    return a;
+}
+// opens device i in Names through backends[i], all with the same format and channels per device
+AudioAggregate AudioAggregate_NewOn(AudioBackend* backends,char** Names,int count,enum _snd_pcm_format format,int bits,int frames_buffer,unsigned int channels,unsigned int rate,unsigned int latency){
+    AudioAggregate a = AudioAggregate_Null();
+    if(bits!=16){
+        printf("[AudioAggregate]: New -> only 16 bit capture can be aggregated!\n");
+        return a;
+    }
+
+    a.count = count;
+    a.format = format;
+    a.bits = bits;
+    a.frames_buffer = frames_buffer;
+    a.channels = channels;
+    a.rate = rate;
+    a.latency = latency;
+    a.buffer = DataStream_New();
+    a.devices = calloc(count,sizeof(AudioAggregateDevice));
+
+    for(int i = 0;i<count;i++){
+        AudioAggregateDevice* d = a.devices + i;
+        snprintf(d->Name,sizeof(d->Name),"%s",Names[i]);
+        d->thread = Thread_Null();
+        d->ring = RingBuffer_New(AUDIOAGGREGATE_PERIODS * (sizeof(AudioAggregatePeriod) + frames_buffer * channels * sizeof(int16_t)));
+        d->fifo_size = frames_buffer * 4;
+        d->fifo = malloc(d->fifo_size * channels * sizeof(float));
+        d->ratio = 1.0;
+
+        AudioConfig cfg;
+        cfg.device = d->Name;
+        cfg.stream = AUDIOBACKEND_CAPTURE;
+        cfg.format = format;
+        cfg.bits = bits;
+        cfg.channels = channels;
+        cfg.rate = rate;
+        cfg.frames = frames_buffer;
+        cfg.latency = latency;
+
+        int err = 0;
+        d->backend = backends[i];
+        d->pcm_handle = d->backend.open(&d->backend,&cfg,&err);
+        if(!d->pcm_handle){
+            fprintf(stderr,"[AudioAggregate]: Couldn't open PCM-Device \"%s\": %s\n",d->Name,snd_strerror(err));
+            AudioAggregate_Free(&a);
+            return AudioAggregate_Null();
+        }
+    }
+    return a;
+}
+AudioAggregate AudioAggregate_New(char** Names,int count,enum _snd_pcm_format format,int bits,int frames_buffer,unsigned int channels,unsigned int rate,unsigned int latency){
+    AudioBackend backends[count];
+    for(int i = 0;i<count;i++) backends[i] = AudioBackend_Alsa();
+    return AudioAggregate_NewOn(backends,Names,count,format,bits,frames_buffer,channels,rate,latency);
+}
+// capture thread of one device, never waits on the merge stage: full rings drop the period
+void* AudioAggregate_Capture(AudioAggregateDevice* d){
+    AudioAggregate* a = d->parent;
+    size_t bytes = a->frames_buffer * a->channels * sizeof(int16_t);
+    char* record = malloc(sizeof(AudioAggregatePeriod) + bytes);
+    AudioAggregatePeriod* p = (AudioAggregatePeriod*)record;
+
+    while(a->running){
+        int err = d->backend.readi(d->pcm_handle,record + sizeof(AudioAggregatePeriod),a->frames_buffer);
+        if(err == -EPIPE){
+            d->backend.prepare(d->pcm_handle);
+            continue;
+        }
+        if(err == -ENODATA) break;
+        if(err < 0){
+            fprintf(stderr,"[AudioAggregate]: Error reading \"%s\": %s\n",d->Name,snd_strerror(err));
+            break;
+        }
+        p->time = d->backend.now(d->pcm_handle);
+        p->position = d->position;
+        p->frames = err;
+        d->position += err;
+        if(!RingBuffer_Push(&d->ring,record,sizeof(AudioAggregatePeriod) + err * a->channels * sizeof(int16_t))) d->dropped++;
+    }
+
+    free(record);
+    return NULL;
+}
+// moves the periods that arrived into the resampler fifo and updates the clock estimate
+void AudioAggregate_Drain(AudioAggregate* a,AudioAggregateDevice* d){
+    AudioAggregatePeriod p;
+    int16_t samples[a->frames_buffer * a->channels];
+
+    while(1){
+        // the start alignment throws away silence first, it is older than anything in the ring
+        if(d->skip > 0 && d->silence > 0){
+            unsigned long long n = d->skip < d->silence ? d->skip : d->silence;
+            d->skip -= n;
+            d->silence -= n;
+        }
+        // periods the capture thread had to drop become silence, so the devices stay aligned,
+        // a gap longer than the fifo goes in piece by piece as the merge stage consumes it
+        if(d->silence > 0){
+            int n = d->fifo_size - d->fifo_frames;
+            if((unsigned long long)n > d->silence) n = d->silence;
+            memset(d->fifo + d->fifo_frames * a->channels,0,n * a->channels * sizeof(float));
+            d->fifo_frames += n;
+            d->silence -= n;
+            if(d->silence > 0) return;
+        }
+
+        if(!RingBuffer_Peek(&d->ring,&p,sizeof(AudioAggregatePeriod))) return;
+        if(d->frames && p.position > d->frames){
+            // frames and last move together, the clock estimate must not see the gap before its time
+            d->silence = p.position - d->frames;
+            d->frames = p.position;
+            d->last = p.time - (Timepoint)p.frames * NANO_SECONDS / a->rate;
+            continue;
+        }
+        unsigned int skip = d->skip < p.frames ? d->skip : p.frames;
+        if(d->fifo_frames + (int)(p.frames - skip) > d->fifo_size) return;
+
+        RingBuffer_Pop(&d->ring,&p,sizeof(AudioAggregatePeriod));
+        RingBuffer_Pop(&d->ring,samples,p.frames * a->channels * sizeof(int16_t));
+
+        if(d->frames==0) d->first = p.time - (Timepoint)p.frames * NANO_SECONDS / a->rate;
+        d->frames = p.position + p.frames;
+        d->last = p.time;
+        d->skip -= skip;
+
+        float* dst = d->fifo + d->fifo_frames * a->channels;
+        for(unsigned int i = skip * a->channels;i<p.frames * a->channels;i++) *dst++ = samples[i];
+        d->fifo_frames += p.frames - skip;
+    }
+}
+double AudioAggregate_Rate(AudioAggregate* a,AudioAggregateDevice* d){
+    double span = Time_Elapsed(d->first,d->last);
+    return span >= AUDIOAGGREGATE_SETTLE ? d->frames / span : a->rate;
+}
+// merge stage: aligns the devices on their first sample time, then resamples every device onto the master clock
+void* AudioAggregate_Merge(AudioAggregate* a){
+    int total = a->count * a->channels;
+    int frames = a->frames_buffer;
+    int16_t* out = malloc(frames * total * sizeof(int16_t));
+    char aligned = 0;
+
+    while(a->running){
+        char ready = 1;
+        for(int i = 0;i<a->count;i++){
+            AudioAggregate_Drain(a,a->devices + i);
+            if(a->devices[i].frames==0) ready = 0;
+        }
+        if(!ready){
+            Thread_Sleep_N((Duration)frames * NANO_SECONDS / a->rate / 4);
+            continue;
+        }
+
+        if(!aligned){
+            Timepoint start = 0;
+            for(int i = 0;i<a->count;i++)
+                if(a->devices[i].first > start) start = a->devices[i].first;
+            for(int i = 0;i<a->count;i++){
+                AudioAggregateDevice* d = a->devices + i;
+                unsigned long long skip = (start - d->first) * a->rate / NANO_SECONDS;
+                int n = skip > (unsigned long long)d->fifo_frames ? d->fifo_frames : (int)skip;
+                memmove(d->fifo,d->fifo + n * a->channels,(d->fifo_frames - n) * a->channels * sizeof(float));
+                d->fifo_frames -= n;
+                // whatever the fifo couldn't hold is still in the ring, Drain discards it as it arrives
+                d->skip = skip - n;
+            }
+            aligned = 1;
+        }
+
+        double master = AudioAggregate_Rate(a,a->devices);
+        char enough = 1;
+        for(int i = 0;i<a->count;i++){
+            AudioAggregateDevice* d = a->devices + i;
+            double ratio = i==0 ? 1.0 : AudioAggregate_Rate(a,d) / master;
+            if(ratio > 1.0 + AUDIOAGGREGATE_MAX_DRIFT) ratio = 1.0 + AUDIOAGGREGATE_MAX_DRIFT;
+            if(ratio < 1.0 - AUDIOAGGREGATE_MAX_DRIFT) ratio = 1.0 - AUDIOAGGREGATE_MAX_DRIFT;
+            d->ratio = ratio;
+            if(d->phase + frames * ratio + 2 > d->fifo_frames) enough = 0;
+        }
+        if(!enough){
+            Thread_Sleep_N((Duration)frames * NANO_SECONDS / a->rate / 4);
+            continue;
+        }
+
+        for(int i = 0;i<a->count;i++){
+            AudioAggregateDevice* d = a->devices + i;
+            double pos = d->phase;
+            for(int f = 0;f<frames;f++){
+                int j = (int)pos;
+                float t = pos - j;
+                float* s0 = d->fifo + j * a->channels;
+                float* s1 = s0 + a->channels;
+                for(unsigned int c = 0;c<a->channels;c++)
+                    out[f * total + i * a->channels + c] = (int16_t)lrintf(s0[c] + (s1[c] - s0[c]) * t);
+                pos += d->ratio;
+            }
+            int used = (int)pos;
+            d->phase = pos - used;
+            memmove(d->fifo,d->fifo + used * a->channels,(d->fifo_frames - used) * a->channels * sizeof(float));
+            d->fifo_frames -= used;
+        }
+        DataStream_PushCount(&a->buffer,out,frames * total * sizeof(int16_t));
+    }
+
+    free(out);
+    return NULL;
+}
+void AudioAggregate_Start(AudioAggregate* a){
+    if(a->running){
+        printf("[AudioAggregate]: Start -> can't start because its already running!\n");
+        return;
+    }
+    a->running = 1;
+    for(int i = 0;i<a->count;i++){
+        AudioAggregateDevice* d = a->devices + i;
+        d->parent = a;
+        if(!d->pcm_handle) continue;
+        d->thread = Thread_New(NULL,(void*)AudioAggregate_Capture,d);
+        Thread_Start(&d->thread);
+    }
+    a->merge = Thread_New(NULL,(void*)AudioAggregate_Merge,a);
+    Thread_Start(&a->merge);
+}
+void AudioAggregate_Stop(AudioAggregate* a){
+    if(!a->running){
+        printf("[AudioAggregate]: Stop -> can't stop because it already stopped!\n");
+        return;
+    }
+    a->running = 0;
+    for(int i = 0;i<a->count;i++)
+        if(a->devices[i].thread.func) Thread_Join(&a->devices[i].thread,NULL);
+    Thread_Join(&a->merge,NULL);
+}
+// channels of device i end up at i * channels in every output frame
+void AudioAggregate_Write(AudioAggregate* a,char* Path){
+    int frame_size = a->bits / 8 * a->channels * a->count;
+    WavFile wf = WavFile_Move(a->rate,a->bits,a->channels * a->count,a->buffer.Memory,a->buffer.size / frame_size,frame_size);
+    WavFile_Write(&wf,Path);
+}
+void AudioAggregate_Print(AudioAggregate* a){
+    printf("--- AudioAggregate ---\n");
+    for(int i = 0;i<a->count;i++){
+        AudioAggregateDevice* d = a->devices + i;
+        printf("[%d] %s: %.2f Hz, ratio %.6f, dropped %llu periods\n",i,d->Name,AudioAggregate_Rate(a,d),d->ratio,d->dropped);
+    }
+    printf("--------------\n");
+}
+void AudioAggregate_Free(AudioAggregate* a){
+    for(int i = 0;i<a->count;i++){
+        AudioAggregateDevice* d = a->devices + i;
+        if(d->pcm_handle) d->backend.close(d->pcm_handle);
+        RingBuffer_Free(&d->ring);
+        if(d->fifo) free(d->fifo);
+    }
+    if(a->devices) free(a->devices);
+    if(a->buffer.Memory) DataStream_Free(&a->buffer);
+    *a = AudioAggregate_Null();
+}
+
+#endif//!AUDIOAGGREGATE_H
@@ -0,0 +1,321 @@
+#ifndef AUDIOBACKEND_H
+#define AUDIOBACKEND_H
+
+#include "AlxTime.h"
+#include "DataStream.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <alsa/asoundlib.h>
+
+#define AUDIOBACKEND_PLAYBACK   0
+#define AUDIOBACKEND_CAPTURE    1
+
+typedef struct AudioConfig{
+    char* device;
+    int stream;
+    enum _snd_pcm_format format;
+    int bits;
+    unsigned int channels;
+    unsigned int rate;          // updated to the rate the device accepted
+    int frames;                 // period in frames
+    unsigned int latency;       // us, capture only
+} AudioConfig;
+
+// everything OAudio/IAudio need from a device, errors are negative errno like snd_pcm_* (-EPIPE = xrun, -ENODATA = source ended)
+typedef struct AudioBackend{
+    const char* Name;
+    void* (*open)(struct AudioBackend* b,AudioConfig* cfg,int* err);
+    long (*writei)(void* h,const void* buffer,unsigned long frames);
+    long (*readi)(void* h,void* buffer,unsigned long frames);
+    int (*prepare)(void* h);
+    int (*drain)(void* h);
+    void (*close)(void* h);
+    Timepoint (*now)(void* h);      // clock of the device, every timestamp of a stream comes from here
+    // optional, lets an open handle switch format without reopening (see AudioPool)
+    int (*configure)(void* h,AudioConfig* cfg,void* cache);    // cache from the cache op skips negotiation
+    void* (*cache)(void* h);                                    // snapshot of the setup h negotiated
+    void (*uncache)(void* cache);
+    void* data;
+} AudioBackend;
+
+
+// capture goes through snd_pcm_set_params, playback through the full hw_params sequence
+int AudioBackend_AlsaConfigure(void* h,AudioConfig* cfg,void* cache){
+    snd_pcm_t* pcm_handle = (snd_pcm_t*)h;
+    char* device = cfg->device ? cfg->device : "default";
+    int err = snd_pcm_hw_free(pcm_handle);
+    if(err < 0) return err;
+
+    snd_pcm_hw_params_t *params;
+    snd_pcm_hw_params_alloca(&params);
+
+    if(cache){
+        snd_pcm_hw_params_copy(params,(snd_pcm_hw_params_t*)cache);
+        if ((err = snd_pcm_hw_params(pcm_handle, params)) < 0)
+            fprintf(stderr, "[AudioBackend]: Couldn't restore params of \"%s\": %s\n", device, snd_strerror(err));
+        return err;
+    }
+
+    if(cfg->stream==AUDIOBACKEND_CAPTURE){
+        if ((err = snd_pcm_set_params(pcm_handle, cfg->format, SND_PCM_ACCESS_RW_INTERLEAVED, cfg->channels, cfg->rate, 1, cfg->latency)) < 0)
+            fprintf(stderr, "[AudioBackend]: Couldn't set params of \"%s\": %s\n", device, snd_strerror(err));
+        return err;
+    }
+
+    snd_pcm_uframes_t buffer_size = cfg->frames * cfg->channels * (cfg->bits / 8);
+
+    if ((err = snd_pcm_hw_params_any(pcm_handle, params)) < 0 ||
+        (err = snd_pcm_hw_params_set_access(pcm_handle, params, SND_PCM_ACCESS_RW_INTERLEAVED)) < 0 ||
+        (err = snd_pcm_hw_params_set_format(pcm_handle, params, cfg->format)) < 0 ||
+        (err = snd_pcm_hw_params_set_channels(pcm_handle, params, cfg->channels)) < 0 ||
+        (err = snd_pcm_hw_params_set_rate_near(pcm_handle, params, &cfg->rate, 0)) < 0 ||
+        (err = snd_pcm_hw_params_set_periods(pcm_handle, params, 4, 0)) < 0 ||
+        (err = snd_pcm_hw_params_set_buffer_size_near(pcm_handle, params, &buffer_size)) < 0 ||
+        (err = snd_pcm_hw_params(pcm_handle, params)) < 0) {
+        fprintf(stderr, "[AudioBackend]: Couldn't set hardware params of \"%s\": %s\n", device, snd_strerror(err));
+    }
+    return err;
+}
+void* AudioBackend_AlsaOpen(AudioBackend* b,AudioConfig* cfg,int* err){
+    snd_pcm_t* pcm_handle = NULL;
+    char* device = cfg->device ? cfg->device : "default";
+    snd_pcm_stream_t stream = cfg->stream==AUDIOBACKEND_CAPTURE ? SND_PCM_STREAM_CAPTURE : SND_PCM_STREAM_PLAYBACK;
+
+    if ((*err = snd_pcm_open(&pcm_handle, device, stream, 0)) < 0) {
+        fprintf(stderr, "[AudioBackend]: Couldn't open PCM-Device \"%s\": %s\n", device, snd_strerror(*err));
+        return NULL;
+    }
+    if ((*err = AudioBackend_AlsaConfigure(pcm_handle, cfg, NULL)) < 0) {
+        snd_pcm_close(pcm_handle);
+        return NULL;
+    }
+    return pcm_handle;
+}
+Timepoint AudioBackend_AlsaNow(void* h){
+    return Time_Nano();
+}
+long AudioBackend_AlsaWrite(void* h,const void* buffer,unsigned long frames){
+    return snd_pcm_writei((snd_pcm_t*)h, buffer, frames);
+}
+long AudioBackend_AlsaRead(void* h,void* buffer,unsigned long frames){
+    return snd_pcm_readi((snd_pcm_t*)h, buffer, frames);
+}
+int AudioBackend_AlsaPrepare(void* h){
+    return snd_pcm_prepare((snd_pcm_t*)h);
+}
+int AudioBackend_AlsaDrain(void* h){
+    return snd_pcm_drain((snd_pcm_t*)h);
+}
+void AudioBackend_AlsaClose(void* h){
+    snd_pcm_close((snd_pcm_t*)h);
+}
+void* AudioBackend_AlsaCache(void* h){
+    snd_pcm_hw_params_t* params = NULL;
+    if(snd_pcm_hw_params_malloc(&params) < 0) return NULL;
+    if(snd_pcm_hw_params_current((snd_pcm_t*)h, params) < 0){
+        snd_pcm_hw_params_free(params);
+        return NULL;
+    }
+    return params;
+}
+void AudioBackend_AlsaUncache(void* cache){
+    snd_pcm_hw_params_free((snd_pcm_hw_params_t*)cache);
+}
+AudioBackend AudioBackend_Alsa(){
+    AudioBackend b;
+    b.Name = "alsa";
+    b.open = AudioBackend_AlsaOpen;
+    b.writei = AudioBackend_AlsaWrite;
+    b.readi = AudioBackend_AlsaRead;
+    b.prepare = AudioBackend_AlsaPrepare;
+    b.drain = AudioBackend_AlsaDrain;
+    b.close = AudioBackend_AlsaClose;
+    b.now = AudioBackend_AlsaNow;
+    b.configure = AudioBackend_AlsaConfigure;
+    b.cache = AudioBackend_AlsaCache;
+    b.uncache = AudioBackend_AlsaUncache;
+    b.data = NULL;
+    return b;
+}
+
+
+// sink and source in memory: playback appends to sink, capture reads source, both as fast as the cpu allows
+typedef struct AudioMemory{
+    DataStream sink;
+    char* source;
+    size_t source_size;
+    size_t pos;
+    char loop;
+    char owned;
+    int frame_size;
+    unsigned int rate;
+    unsigned int channels;
+    int bits;
+    // device clock: frames moved so far at the configured rate, plus the jitter of the last call
+    unsigned long long transferred;
+    long long offset;
+    double jitter;          // seconds of gaussian jitter per call, only the sim backend applies it
+    double xrun;            // probability of an xrun per call
+    double shortio;         // probability that a call only transfers part of the frames
+    unsigned int seed;
+    char broken;
+    unsigned long long xruns;
+    unsigned long long calls;
+} AudioMemory;
+
+AudioMemory AudioMemory_New(){
+    AudioMemory m;
+    memset(&m,0,sizeof(AudioMemory));
+    m.sink = DataStream_New();
+    m.seed = 0x12345678;
+    return m;
+}
+// capture reads data, loop starts over at the end instead of returning -ENODATA
+void AudioMemory_Source(AudioMemory* m,char* data,size_t size,char loop){
+    if(m->owned && m->source) free(m->source);
+    m->source = data;
+    m->source_size = size;
+    m->pos = 0;
+    m->loop = loop;
+    m->owned = 0;
+}
+// xruns and short transfers are drawn from a fixed seed, so every run injects the same faults
+void AudioMemory_Faults(AudioMemory* m,double xrun,double jitter,double shortio,unsigned int seed){
+    m->xrun = xrun;
+    m->jitter = jitter;
+    m->shortio = shortio;
+    m->seed = seed ? seed : 0x12345678;
+}
+double AudioMemory_Random(AudioMemory* m){
+    m->seed ^= m->seed << 13;
+    m->seed ^= m->seed >> 17;
+    m->seed ^= m->seed << 5;
+    return (m->seed & 0xFFFFFF) / (double)0x1000000;
+}
+Timepoint AudioMemory_Now(AudioMemory* m){
+    Timepoint clock = m->rate ? Time_SecToNano((double)m->transferred / m->rate) : 0;
+    return m->offset < 0 && (Timepoint)-m->offset > clock ? 0 : clock + m->offset;
+}
+void AudioMemory_Clear(AudioMemory* m){
+    m->sink.size = 0;
+    m->pos = 0;
+    m->transferred = 0;
+    m->offset = 0;
+    m->broken = 0;
+    m->xruns = 0;
+    m->calls = 0;
+}
+void AudioMemory_Free(AudioMemory* m){
+    if(m->owned && m->source) free(m->source);
+    DataStream_Free(&m->sink);
+    memset(m,0,sizeof(AudioMemory));
+}
+
+int AudioBackend_MemoryConfigure(void* h,AudioConfig* cfg,void* cache){
+    AudioMemory* m = (AudioMemory*)h;
+    m->frame_size = cfg->channels * (cfg->bits / 8);
+    m->rate = cfg->rate;
+    m->channels = cfg->channels;
+    m->bits = cfg->bits;
+    m->broken = 0;
+    return 0;
+}
+void* AudioBackend_MemoryOpen(AudioBackend* b,AudioConfig* cfg,int* err){
+    AudioMemory* m = (AudioMemory*)b->data;
+    *err = AudioBackend_MemoryConfigure(m,cfg,NULL);
+    return m;
+}
+long AudioBackend_MemoryWrite(void* h,const void* buffer,unsigned long frames){
+    AudioMemory* m = (AudioMemory*)h;
+    DataStream_PushCount(&m->sink,(void*)buffer,frames * m->frame_size);
+    m->transferred += frames;
+    return frames;
+}
+long AudioBackend_MemoryRead(void* h,void* buffer,unsigned long frames){
+    AudioMemory* m = (AudioMemory*)h;
+    size_t done = 0;
+    while(done < frames){
+        if(m->pos + m->frame_size > m->source_size){
+            if(!m->loop || m->source_size < (size_t)m->frame_size) break;
+            m->pos = 0;
+        }
+        size_t n = (m->source_size - m->pos) / m->frame_size;
+        if(n > frames - done) n = frames - done;
+        if(n==0) break;
+        memcpy((char*)buffer + done * m->frame_size,m->source + m->pos,n * m->frame_size);
+        m->pos += n * m->frame_size;
+        done += n;
+    }
+    m->transferred += done;
+    return done==0 && frames>0 ? -ENODATA : (long)done;
+}
+int AudioBackend_MemoryPrepare(void* h){
+    ((AudioMemory*)h)->broken = 0;
+    return 0;
+}
+int AudioBackend_MemoryDrain(void* h){
+    return 0;
+}
+void AudioBackend_MemoryClose(void* h){
+}
+Timepoint AudioBackend_MemoryNow(void* h){
+    return AudioMemory_Now((AudioMemory*)h);
+}
+AudioBackend AudioBackend_Memory(AudioMemory* m){
+    AudioBackend b;
+    b.Name = "memory";
+    b.open = AudioBackend_MemoryOpen;
+    b.writei = AudioBackend_MemoryWrite;
+    b.readi = AudioBackend_MemoryRead;
+    b.prepare = AudioBackend_MemoryPrepare;
+    b.drain = AudioBackend_MemoryDrain;
+    b.close = AudioBackend_MemoryClose;
+    b.now = AudioBackend_MemoryNow;
+    b.configure = AudioBackend_MemoryConfigure;
+    b.cache = NULL;
+    b.uncache = NULL;
+    b.data = m;
+    return b;
+}
+
+// memory backend with injected xruns, short transfers and timestamps that jitter around the device clock
+long AudioBackend_SimTransfer(AudioMemory* m,unsigned long* frames){
+    m->calls++;
+    if(m->broken) return -EPIPE;
+    if(m->xrun > 0.0 && AudioMemory_Random(m) < m->xrun){
+        m->broken = 1;
+        m->xruns++;
+        return -EPIPE;
+    }
+    if(m->shortio > 0.0 && *frames > 1 && AudioMemory_Random(m) < m->shortio)
+        *frames = 1 + (unsigned long)(AudioMemory_Random(m) * (*frames - 1));
+
+    m->offset = 0;
+    if(m->jitter > 0.0){
+        double u1 = AudioMemory_Random(m) + 1e-12;
+        double u2 = AudioMemory_Random(m);
+        m->offset = (long long)(m->jitter * sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2) * TIME_FNANOTOSEC);
+    }
+    return 0;
+}
+long AudioBackend_SimWrite(void* h,const void* buffer,unsigned long frames){
+    long err = AudioBackend_SimTransfer((AudioMemory*)h,&frames);
+    return err < 0 ? err : AudioBackend_MemoryWrite(h,buffer,frames);
+}
+long AudioBackend_SimRead(void* h,void* buffer,unsigned long frames){
+    long err = AudioBackend_SimTransfer((AudioMemory*)h,&frames);
+    return err < 0 ? err : AudioBackend_MemoryRead(h,buffer,frames);
+}
+AudioBackend AudioBackend_Sim(AudioMemory* m){
+    AudioBackend b = AudioBackend_Memory(m);
+    b.Name = "sim";
+    b.writei = AudioBackend_SimWrite;
+    b.readi = AudioBackend_SimRead;
+    return b;
+}
+
+#endif//!AUDIOBACKEND_H
@@ -0,0 +1,222 @@
+#ifndef AUDIOBUS_H
+#define AUDIOBUS_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define AUDIOBUS_MAGIC      0x53554241      // "ABUS"
+#define AUDIOBUS_PAGE       4096
+
+// lives at the start of the shared mapping, the ring follows after AUDIOBUS_PAGE bytes
+typedef struct AudioBusHeader{
+    uint32_t magic;
+    int32_t format;
+    uint32_t rate;
+    uint32_t channels;
+    uint32_t bits;
+    uint32_t frame_size;
+    uint32_t period;        // frames per period
+    uint32_t capacity;      // frames in the ring, a multiple of period
+    _Atomic uint64_t cursor;// frames written since start, published after the data
+} AudioBusHeader;
+
+typedef struct AudioBus{
+    char Name[64];
+    int fd;
+    size_t size;
+    AudioBusHeader* header;
+    char* ring;
+} AudioBus;
+
+typedef struct AudioBusReader{
+    int fd;
+    size_t size;
+    const AudioBusHeader* header;
+    const char* ring;
+    uint64_t cursor;
+    unsigned long long overruns;
+    unsigned long long lost;
+} AudioBusReader;
+
+AudioBus AudioBus_Null(){
+    AudioBus b;
+    memset(&b,0,sizeof(AudioBus));
+    b.fd = -1;
+    return b;
+}
+// creates the shared ring /dev/shm/<Name> holding periods * period frames
+AudioBus AudioBus_New(char* Name,int format,unsigned int rate,unsigned int channels,unsigned int bits,unsigned int period,unsigned int periods){
+    AudioBus b = AudioBus_Null();
+    snprintf(b.Name,sizeof(b.Name),"/%s",Name);
+
+    uint32_t frame_size = channels * bits / 8;
+    b.size = AUDIOBUS_PAGE + (size_t)period * periods * frame_size;
+
+    b.fd = shm_open(b.Name,O_CREAT | O_RDWR | O_TRUNC,0644);
+    if(b.fd<0){
+        printf("[AudioBus]: New -> couldn't create \"%s\"!\n",b.Name);
+        return AudioBus_Null();
+    }
+    if(ftruncate(b.fd,b.size)<0){
+        printf("[AudioBus]: New -> couldn't resize \"%s\"!\n",b.Name);
+        close(b.fd);
+        shm_unlink(b.Name);
+        return AudioBus_Null();
+    }
+
+    void* map = mmap(NULL,b.size,PROT_READ | PROT_WRITE,MAP_SHARED,b.fd,0);
+    if(map==MAP_FAILED){
+        printf("[AudioBus]: New -> couldn't map \"%s\"!\n",b.Name);
+        close(b.fd);
+        shm_unlink(b.Name);
+        return AudioBus_Null();
+    }
+
+    b.header = (AudioBusHeader*)map;
+    b.ring = (char*)map + AUDIOBUS_PAGE;
+    b.header->format = format;
+    b.header->rate = rate;
+    b.header->channels = channels;
+    b.header->bits = bits;
+    b.header->frame_size = frame_size;
+    b.header->period = period;
+    b.header->capacity = period * periods;
+    atomic_store_explicit(&b.header->cursor,0,memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    b.header->magic = AUDIOBUS_MAGIC;
+    return b;
+}
+// where the next period goes, the producer can read straight into it
+char* AudioBus_Slot(AudioBus* b){
+    uint64_t cursor = atomic_load_explicit(&b->header->cursor,memory_order_relaxed);
+    return b->ring + (cursor % b->header->capacity) * b->header->frame_size;
+}
+// makes frames written into AudioBus_Slot visible to all readers
+void AudioBus_Publish(AudioBus* b,unsigned int frames){
+    atomic_fetch_add_explicit(&b->header->cursor,frames,memory_order_release);
+}
+void AudioBus_Write(AudioBus* b,char* data,unsigned int frames){
+    while(frames>0){
+        uint64_t cursor = atomic_load_explicit(&b->header->cursor,memory_order_relaxed);
+        unsigned int offset = cursor % b->header->capacity;
+        unsigned int n = b->header->capacity - offset;
+        if(n > frames) n = frames;
+        memcpy(b->ring + offset * b->header->frame_size,data,n * b->header->frame_size);
+        AudioBus_Publish(b,n);
+        data += n * b->header->frame_size;
+        frames -= n;
+    }
+}
+void AudioBus_Free(AudioBus* b){
+    if(b->header) munmap(b->header,b->size);
+    if(b->fd>=0){
+        close(b->fd);
+        shm_unlink(b->Name);
+    }
+    *b = AudioBus_Null();
+}
+
+
+AudioBusReader AudioBusReader_Null(){
+    AudioBusReader r;
+    memset(&r,0,sizeof(AudioBusReader));
+    r.fd = -1;
+    return r;
+}
+// maps the bus read-only and starts at the current write position
+AudioBusReader AudioBusReader_New(char* Name){
+    AudioBusReader r = AudioBusReader_Null();
+    char path[64];
+    snprintf(path,sizeof(path),"/%s",Name);
+
+    r.fd = shm_open(path,O_RDONLY,0);
+    if(r.fd<0){
+        printf("[AudioBus]: Reader -> couldn't open \"%s\"!\n",path);
+        return AudioBusReader_Null();
+    }
+    struct stat st;
+    if(fstat(r.fd,&st)<0 || (size_t)st.st_size < AUDIOBUS_PAGE){
+        printf("[AudioBus]: Reader -> \"%s\" is no audio bus!\n",path);
+        close(r.fd);
+        return AudioBusReader_Null();
+    }
+    r.size = st.st_size;
+
+    void* map = mmap(NULL,r.size,PROT_READ,MAP_SHARED,r.fd,0);
+    if(map==MAP_FAILED){
+        printf("[AudioBus]: Reader -> couldn't map \"%s\"!\n",path);
+        close(r.fd);
+        return AudioBusReader_Null();
+    }
+    r.header = (const AudioBusHeader*)map;
+    r.ring = (const char*)map + AUDIOBUS_PAGE;
+    if(r.header->magic!=AUDIOBUS_MAGIC || AUDIOBUS_PAGE + (size_t)r.header->capacity * r.header->frame_size > r.size){
+        printf("[AudioBus]: Reader -> \"%s\" is no audio bus!\n",path);
+        munmap(map,r.size);
+        close(r.fd);
+        return AudioBusReader_Null();
+    }
+    atomic_thread_fence(memory_order_acquire);
+    r.cursor = atomic_load_explicit((_Atomic uint64_t*)&r.header->cursor,memory_order_acquire);
+    return r;
+}
+uint64_t AudioBusReader_Cursor(AudioBusReader* r){
+    return atomic_load_explicit((_Atomic uint64_t*)&r->header->cursor,memory_order_acquire);
+}
+// frames that can be read without wrapping, data points straight into the shared ring (0 = nothing new)
+unsigned int AudioBusReader_Peek(AudioBusReader* r,const char** data){
+    uint64_t cursor = AudioBusReader_Cursor(r);
+    uint64_t capacity = r->header->capacity;
+
+    // the writer lapped us, everything older than one period before the writer is unsafe
+    if(cursor - r->cursor > capacity - r->header->period){
+        uint64_t next = cursor - (capacity - r->header->period);
+        r->lost += next - r->cursor;
+        r->overruns++;
+        r->cursor = next;
+    }
+
+    unsigned int offset = r->cursor % capacity;
+    uint64_t n = cursor - r->cursor;
+    if(n > capacity - offset) n = capacity - offset;
+    *data = r->ring + (size_t)offset * r->header->frame_size;
+    return n;
+}
+// releases frames returned by Peek, returns 0 if the writer overwrote them while they were being used
+char AudioBusReader_Consume(AudioBusReader* r,unsigned int frames){
+    uint64_t cursor = AudioBusReader_Cursor(r);
+    char valid = cursor - r->cursor <= (uint64_t)(r->header->capacity - r->header->period);
+    if(!valid){
+        r->overruns++;
+        r->lost += frames;
+    }
+    r->cursor += frames;
+    return valid;
+}
+// copies up to frames frames into data, returns how many were copied
+unsigned int AudioBusReader_Read(AudioBusReader* r,char* data,unsigned int frames){
+    unsigned int done = 0;
+    while(done < frames){
+        const char* src;
+        unsigned int n = AudioBusReader_Peek(r,&src);
+        if(n==0) break;
+        if(n > frames - done) n = frames - done;
+        memcpy(data + (size_t)done * r->header->frame_size,src,(size_t)n * r->header->frame_size);
+        if(AudioBusReader_Consume(r,n)) done += n;
+    }
+    return done;
+}
+void AudioBusReader_Free(AudioBusReader* r){
+    if(r->header) munmap((void*)r->header,r->size);
+    if(r->fd>=0) close(r->fd);
+    *r = AudioBusReader_Null();
+}
+
+#endif//!AUDIOBUS_H
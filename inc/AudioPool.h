@@ -0,0 +1,288 @@
+#ifndef AUDIOPOOL_H
+#define AUDIOPOOL_H
+
+#include "AudioBackend.h"
+
+#include <pthread.h>
+
+#define AUDIOPOOL_BUCKETS       64
+
+typedef struct AudioPoolStream AudioPoolStream;
+
+// one negotiated configuration per device, stream, format, channels, rate and period
+typedef struct AudioPoolFormat{
+    char device[64];
+    AudioConfig key;            // as requested, device points into the entry
+    unsigned int rate;          // what the device accepted
+    void* cache;                // backend snapshot, reapplied without negotiation
+    AudioPoolStream* idle;      // open handles already set up with this format
+    struct AudioPoolFormat* next;
+} AudioPoolFormat;
+
+struct AudioPoolStream{
+    struct AudioPool* pool;
+    void* handle;
+    AudioPoolFormat* format;
+    AudioPoolStream* next_idle;
+    AudioPoolStream* next;
+    char busy;
+    char cold;                  // came from a fresh open
+    char waiting;               // no sample moved since open
+    Timepoint acquired;
+};
+
+typedef struct AudioPoolLatency{
+    unsigned long long opens;
+    Duration open;              // summed time spent in open
+    unsigned long long firsts;
+    Duration first;             // summed open-to-first-sample
+    Duration max;               // worst open-to-first-sample
+} AudioPoolLatency;
+
+// keeps handles of the inner backend open and prepared, AudioPool_Backend hands them out through open/close
+typedef struct AudioPool{
+    AudioBackend inner;
+    char running;
+    pthread_mutex_t mutex;
+    AudioPoolFormat* buckets[AUDIOPOOL_BUCKETS];
+    AudioPoolStream* streams;
+    unsigned long long hits;
+    unsigned long long reconfigures;
+    unsigned long long opens;
+    AudioPoolLatency cold;      // the handle had to be opened
+    AudioPoolLatency warm;      // an idle handle was reused
+} AudioPool;
+
+AudioPool AudioPool_Null(){
+    AudioPool p;
+    memset(&p,0,sizeof(AudioPool));
+    return p;
+}
+AudioPool AudioPool_New(AudioBackend inner){
+    AudioPool p = AudioPool_Null();
+    p.inner = inner;
+    return p;
+}
+// sets up the lock on the callers pool, streams can only be opened after this
+void AudioPool_Start(AudioPool* p){
+    if(p->running){
+        printf("[AudioPool]: Start -> can't start because its already running!\n");
+        return;
+    }
+    pthread_mutex_init(&p->mutex,NULL);
+    p->running = 1;
+}
+unsigned int AudioPool_Hash(AudioConfig* cfg){
+    unsigned int h = 2166136261u;
+    for(const char* c = cfg->device ? cfg->device : "default";*c;c++) h = (h ^ (unsigned char)*c) * 16777619u;
+    unsigned int fields[] = { cfg->stream,cfg->format,cfg->bits,cfg->channels,cfg->rate,cfg->frames,cfg->latency };
+    for(int i = 0;i<7;i++) h = (h ^ fields[i]) * 16777619u;
+    return h % AUDIOPOOL_BUCKETS;
+}
+char AudioPool_Same(AudioConfig* a,AudioConfig* b){
+    return a->stream==b->stream && a->format==b->format && a->bits==b->bits && a->channels==b->channels &&
+        a->rate==b->rate && a->frames==b->frames && a->latency==b->latency &&
+        strcmp(a->device ? a->device : "default",b->device ? b->device : "default")==0;
+}
+AudioPoolFormat* AudioPool_Format(AudioPool* p,AudioConfig* cfg){
+    unsigned int h = AudioPool_Hash(cfg);
+    for(AudioPoolFormat* f = p->buckets[h];f;f = f->next)
+        if(AudioPool_Same(&f->key,cfg)) return f;
+
+    AudioPoolFormat* f = calloc(1,sizeof(AudioPoolFormat));
+    snprintf(f->device,sizeof(f->device),"%s",cfg->device ? cfg->device : "default");
+    f->key = *cfg;
+    f->key.device = f->device;
+    f->rate = cfg->rate;
+    f->next = p->buckets[h];
+    p->buckets[h] = f;
+    return f;
+}
+void AudioPool_Unlink(AudioPoolStream* s){
+    AudioPoolStream** it = &s->format->idle;
+    while(*it && *it!=s) it = &(*it)->next_idle;
+    if(*it) *it = s->next_idle;
+    s->next_idle = NULL;
+}
+// idle handle of the same format first, then any idle handle on the same device that can be reconfigured, then a new one
+void* AudioPool_Open(AudioBackend* b,AudioConfig* cfg,int* err){
+    AudioPool* p = (AudioPool*)b->data;
+    if(!p->running){
+        printf("[AudioPool]: Open -> pool isn't started!\n");
+        *err = -EINVAL;
+        return NULL;
+    }
+    Timepoint start = Time_Nano();
+    *err = 0;
+
+    pthread_mutex_lock(&p->mutex);
+    AudioPoolFormat* f = AudioPool_Format(p,cfg);
+    AudioPoolStream* s = f->idle;
+    char cold = 0;
+
+    if(s){
+        f->idle = s->next_idle;
+        s->next_idle = NULL;
+        p->hits++;
+    }else if(p->inner.configure){
+        for(AudioPoolStream* it = p->streams;it;it = it->next){
+            if(it->busy || !it->handle || it->format->key.stream!=cfg->stream || strcmp(it->format->device,f->device)!=0) continue;
+            AudioPool_Unlink(it);
+            if((*err = p->inner.configure(it->handle,cfg,f->cache)) < 0){
+                p->inner.close(it->handle);
+                it->handle = NULL;
+                it->format = f;
+                break;
+            }
+            if(f->cache) cfg->rate = f->rate;
+            else f->rate = cfg->rate;
+            it->format = f;
+            s = it;
+            p->reconfigures++;
+            break;
+        }
+    }
+
+    if(!s){
+        for(AudioPoolStream* it = p->streams;it && !s;it = it->next)
+            if(!it->busy && !it->handle) s = it;
+        if(!s){
+            s = calloc(1,sizeof(AudioPoolStream));
+            s->pool = p;
+            s->next = p->streams;
+            p->streams = s;
+        }
+        s->handle = p->inner.open(&p->inner,cfg,err);
+        s->format = f;
+        if(!s->handle){
+            pthread_mutex_unlock(&p->mutex);
+            return NULL;
+        }
+        f->rate = cfg->rate;
+        p->opens++;
+        cold = 1;
+    }
+
+    if(!f->cache && p->inner.cache) f->cache = p->inner.cache(s->handle);
+    cfg->rate = f->rate;
+    s->busy = 1;
+    s->cold = cold;
+    s->waiting = 1;
+    s->acquired = start;
+    AudioPoolLatency* l = cold ? &p->cold : &p->warm;
+    l->opens++;
+    l->open += Time_Nano() - start;
+    pthread_mutex_unlock(&p->mutex);
+    return s;
+}
+// counts the time from open until the first period was handed to the device
+void AudioPool_First(AudioPoolStream* s){
+    Duration d = Time_Nano() - s->acquired;
+    AudioPoolLatency* l = s->cold ? &s->pool->cold : &s->pool->warm;
+    pthread_mutex_lock(&s->pool->mutex);
+    l->firsts++;
+    l->first += d;
+    if(d > l->max) l->max = d;
+    pthread_mutex_unlock(&s->pool->mutex);
+    s->waiting = 0;
+}
+long AudioPool_Write(void* h,const void* buffer,unsigned long frames){
+    AudioPoolStream* s = (AudioPoolStream*)h;
+    long err = s->pool->inner.writei(s->handle,buffer,frames);
+    if(s->waiting && err > 0) AudioPool_First(s);
+    return err;
+}
+long AudioPool_Read(void* h,void* buffer,unsigned long frames){
+    AudioPoolStream* s = (AudioPoolStream*)h;
+    long err = s->pool->inner.readi(s->handle,buffer,frames);
+    if(s->waiting && err > 0) AudioPool_First(s);
+    return err;
+}
+int AudioPool_Prepare(void* h){
+    AudioPoolStream* s = (AudioPoolStream*)h;
+    return s->pool->inner.prepare(s->handle);
+}
+int AudioPool_Drain(void* h){
+    AudioPoolStream* s = (AudioPoolStream*)h;
+    return s->pool->inner.drain(s->handle);
+}
+Timepoint AudioPool_Now(void* h){
+    AudioPoolStream* s = (AudioPoolStream*)h;
+    return s->pool->inner.now(s->handle);
+}
+// the handle stays open and gets prepared for the next open with the same format
+void AudioPool_Close(void* h){
+    AudioPoolStream* s = (AudioPoolStream*)h;
+    AudioPool* p = s->pool;
+    int err = p->inner.prepare(s->handle);
+
+    pthread_mutex_lock(&p->mutex);
+    if(err < 0){
+        p->inner.close(s->handle);
+        s->handle = NULL;
+    }else{
+        s->next_idle = s->format->idle;
+        s->format->idle = s;
+    }
+    s->busy = 0;
+    s->waiting = 0;
+    pthread_mutex_unlock(&p->mutex);
+}
+AudioBackend AudioPool_Backend(AudioPool* p){
+    AudioBackend b;
+    b.Name = "pool";
+    b.open = AudioPool_Open;
+    b.writei = AudioPool_Write;
+    b.readi = AudioPool_Read;
+    b.prepare = AudioPool_Prepare;
+    b.drain = AudioPool_Drain;
+    b.close = AudioPool_Close;
+    b.now = AudioPool_Now;
+    b.configure = NULL;
+    b.cache = NULL;
+    b.uncache = NULL;
+    b.data = p;
+    return b;
+}
+// opens and prepares a handle ahead of time, so even the first open is warm
+int AudioPool_Reserve(AudioPool* p,AudioConfig* cfg){
+    AudioBackend b = AudioPool_Backend(p);
+    int err = 0;
+    AudioPoolStream* s = (AudioPoolStream*)AudioPool_Open(&b,cfg,&err);
+    if(!s) return err;
+    AudioPool_Close(s);
+    return 0;
+}
+void AudioPool_Print(AudioPool* p){
+    printf("[AudioPool]: %llu hits, %llu reconfigures, %llu opens\n",p->hits,p->reconfigures,p->opens);
+    AudioPoolLatency* l[2] = { &p->cold,&p->warm };
+    const char* Name[2] = { "cold","warm" };
+    for(int i = 0;i<2;i++){
+        if(l[i]->opens==0) continue;
+        printf("[AudioPool]: %s: %llu opens, %.3f ms avg open",Name[i],l[i]->opens,l[i]->open / (1.0E6 * l[i]->opens));
+        if(l[i]->firsts>0) printf(", open-to-first-sample %.3f ms avg, %.3f ms max",l[i]->first / (1.0E6 * l[i]->firsts),l[i]->max / 1.0E6);
+        printf("\n");
+    }
+}
+// closes every pooled handle, streams still in use must be closed first
+void AudioPool_Free(AudioPool* p){
+    for(AudioPoolStream* s = p->streams;s;){
+        AudioPoolStream* next = s->next;
+        if(s->busy) printf("[AudioPool]: Free -> a stream is still in use!\n");
+        if(s->handle) p->inner.close(s->handle);
+        free(s);
+        s = next;
+    }
+    for(int i = 0;i<AUDIOPOOL_BUCKETS;i++){
+        for(AudioPoolFormat* f = p->buckets[i];f;){
+            AudioPoolFormat* next = f->next;
+            if(f->cache && p->inner.uncache) p->inner.uncache(f->cache);
+            free(f);
+            f = next;
+        }
+    }
+    if(p->running) pthread_mutex_destroy(&p->mutex);
+    *p = AudioPool_Null();
+}
+
+#endif//!AUDIOPOOL_H
@@ -0,0 +1,270 @@
+#ifndef AUDIOPREROLL_H
+#define AUDIOPREROLL_H
+
+#include "Audio.h"
+
+#include <stdatomic.h>
+
+#define AUDIOPREROLL_CLIPS      2
+
+#define AUDIOPREROLL_FREE       0
+#define AUDIOPREROLL_RECORDING  1
+#define AUDIOPREROLL_WRITING    2
+
+typedef struct AudioPrerollClip{
+    char* Memory;
+    int size;
+    int SIZE;
+    char state;
+    char Path[256];
+} AudioPrerollClip;
+
+// captures all the time into a fixed ring, a trigger turns the last pre seconds plus the next post seconds into a wav
+typedef struct AudioPreroll{
+    void *pcm_handle;
+    AudioBackend backend;
+    Thread thread;
+    Thread writer;
+    char running;
+    char writing;
+    enum _snd_pcm_format format;
+    int bits;
+    int frames_buffer;
+    unsigned int channels;
+    unsigned int rate;
+    unsigned int latency;
+    char* ring;
+    int ring_size;
+    int ring_head;
+    int ring_fill;
+    AudioPrerollClip clips[AUDIOPREROLL_CLIPS];
+    int recording;
+    atomic_int trigger;
+    int level;              // peak that triggers by itself, 0 = manual only
+    char Path[200];
+    int count;
+    unsigned long long missed;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+} AudioPreroll;
+
+AudioPreroll AudioPreroll_Null(){
+    AudioPreroll p;
+    memset(&p,0,sizeof(AudioPreroll));
+    p.thread = Thread_Null();
+    p.writer = Thread_Null();
+    p.recording = -1;
+    return p;
+}
+// all memory is allocated here, clips end up as <Path>_<index>.wav
+AudioPreroll AudioPreroll_NewOn(AudioBackend backend,enum _snd_pcm_format format,int bits,int frames_buffer,unsigned int channels,unsigned int rate,unsigned int latency,double pre,double post,char* Path){
+    AudioPreroll p = AudioPreroll_Null();
+    if(bits!=16){
+        printf("[AudioPreroll]: New -> only 16 bit capture is supported!\n");
+        return p;
+    }
+
+    int frame_size = bits / 8 * channels;
+    p.format = format;
+    p.bits = bits;
+    p.frames_buffer = frames_buffer;
+    p.channels = channels;
+    p.rate = rate;
+    p.latency = latency;
+    p.ring_size = (int)(pre * rate) * frame_size;
+    p.ring = p.ring_size > 0 ? malloc(p.ring_size) : NULL;
+    snprintf(p.Path,sizeof(p.Path),"%s",Path);
+    atomic_init(&p.trigger,0);
+
+    for(int i = 0;i<AUDIOPREROLL_CLIPS;i++){
+        p.clips[i].SIZE = p.ring_size + (int)(post * rate) * frame_size;
+        p.clips[i].Memory = malloc(p.clips[i].SIZE);
+        p.clips[i].size = 0;
+        p.clips[i].state = AUDIOPREROLL_FREE;
+    }
+
+    AudioConfig cfg;
+    cfg.device = NULL;
+    cfg.stream = AUDIOBACKEND_CAPTURE;
+    cfg.format = format;
+    cfg.bits = bits;
+    cfg.channels = channels;
+    cfg.rate = rate;
+    cfg.frames = frames_buffer;
+    cfg.latency = latency;
+
+    int err = 0;
+    p.backend = backend;
+    p.pcm_handle = backend.open(&backend,&cfg,&err);
+    if(!p.pcm_handle) fprintf(stderr,"[AudioPreroll]: Couldn't open PCM-Device: %s\n",snd_strerror(err));
+    return p;
+}
+AudioPreroll AudioPreroll_New(enum _snd_pcm_format format,int bits,int frames_buffer,unsigned int channels,unsigned int rate,unsigned int latency,double pre,double post,char* Path){
+    return AudioPreroll_NewOn(AudioBackend_Alsa(),format,bits,frames_buffer,channels,rate,latency,pre,post,Path);
+}
+// triggers as soon as a period peaks at or above threshold dBFS
+void AudioPreroll_Level(AudioPreroll* p,float threshold){
+    p->level = (int)(32767.0 * pow(10.0,threshold / 20.0));
+    if(p->level<1) p->level = 1;
+}
+// can be called from any thread, the next captured period starts the clip
+void AudioPreroll_Trigger(AudioPreroll* p){
+    atomic_store_explicit(&p->trigger,1,memory_order_release);
+}
+void AudioPreroll_RingPush(AudioPreroll* p,char* data,int bytes){
+    if(p->ring_size==0) return;
+    if(bytes > p->ring_size){
+        data += bytes - p->ring_size;
+        bytes = p->ring_size;
+    }
+    int first = p->ring_size - p->ring_head < bytes ? p->ring_size - p->ring_head : bytes;
+    memcpy(p->ring + p->ring_head,data,first);
+    memcpy(p->ring,data + first,bytes - first);
+    p->ring_head = (p->ring_head + bytes) % p->ring_size;
+    p->ring_fill = p->ring_fill + bytes > p->ring_size ? p->ring_size : p->ring_fill + bytes;
+}
+// hands the clip to the writer thread
+void AudioPreroll_Finish(AudioPreroll* p){
+    pthread_mutex_lock(&p->mutex);
+    p->clips[p->recording].state = AUDIOPREROLL_WRITING;
+    pthread_cond_broadcast(&p->cond);
+    pthread_mutex_unlock(&p->mutex);
+    p->recording = -1;
+}
+// copies the pre-roll into a free clip, misses the trigger if the writer still holds all of them
+void AudioPreroll_Begin(AudioPreroll* p){
+    int free_clip = -1;
+    pthread_mutex_lock(&p->mutex);
+    for(int i = 0;i<AUDIOPREROLL_CLIPS;i++){
+        if(p->clips[i].state==AUDIOPREROLL_FREE){
+            free_clip = i;
+            p->clips[i].state = AUDIOPREROLL_RECORDING;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&p->mutex);
+
+    if(free_clip<0){
+        p->missed++;
+        return;
+    }
+
+    AudioPrerollClip* c = p->clips + free_clip;
+    int oldest = (p->ring_head - p->ring_fill + p->ring_size) % (p->ring_size ? p->ring_size : 1);
+    int first = p->ring_size - oldest < p->ring_fill ? p->ring_size - oldest : p->ring_fill;
+    memcpy(c->Memory,p->ring + oldest,first);
+    memcpy(c->Memory + first,p->ring,p->ring_fill - first);
+    c->size = p->ring_fill;
+    snprintf(c->Path,sizeof(c->Path),"%s_%03d.wav",p->Path,p->count++);
+    p->recording = free_clip;
+}
+void* AudioPreroll_Execute(AudioPreroll* p){
+    int frame_size = p->bits / 8 * p->channels;
+    int16_t* buffer = malloc(p->frames_buffer * frame_size);
+
+    while(p->running){
+        int err = p->backend.readi(p->pcm_handle,buffer,p->frames_buffer);
+        if(err == -EPIPE){
+            p->backend.prepare(p->pcm_handle);
+            continue;
+        }
+        if(err == -ENODATA) break;
+        if(err < 0){
+            fprintf(stderr,"[AudioPreroll]: Error reading audio: %s\n",snd_strerror(err));
+            break;
+        }
+        int bytes = err * frame_size;
+
+        if(p->recording>=0){
+            AudioPrerollClip* c = p->clips + p->recording;
+            int n = c->SIZE - c->size < bytes ? c->SIZE - c->size : bytes;
+            memcpy(c->Memory + c->size,buffer,n);
+            c->size += n;
+            if(c->size==c->SIZE) AudioPreroll_Finish(p);
+        }
+
+        AudioPreroll_RingPush(p,(char*)buffer,bytes);
+
+        char fire = atomic_exchange_explicit(&p->trigger,0,memory_order_acquire);
+        if(!fire && p->level>0 && p->recording<0){
+            int peak = 0;
+            for(int i = 0;i<err * (int)p->channels;i++){
+                int v = buffer[i] < 0 ? -buffer[i] : buffer[i];
+                peak = v > peak ? v : peak;
+            }
+            fire = peak >= p->level;
+        }
+        if(fire && p->recording<0) AudioPreroll_Begin(p);
+    }
+
+    if(p->recording>=0) AudioPreroll_Finish(p);
+    free(buffer);
+    return NULL;
+}
+// writes finished clips while capture goes on
+void* AudioPreroll_Writer(AudioPreroll* p){
+    int frame_size = p->bits / 8 * p->channels;
+
+    pthread_mutex_lock(&p->mutex);
+    while(1){
+        int next = -1;
+        for(int i = 0;i<AUDIOPREROLL_CLIPS;i++)
+            if(p->clips[i].state==AUDIOPREROLL_WRITING) next = i;
+        if(next<0){
+            if(!p->writing) break;
+            pthread_cond_wait(&p->cond,&p->mutex);
+            continue;
+        }
+        pthread_mutex_unlock(&p->mutex);
+
+        AudioPrerollClip* c = p->clips + next;
+        WavFile wf = WavFile_Move(p->rate,p->bits,p->channels,c->Memory,c->size / frame_size,frame_size);
+        WavFile_Write(&wf,c->Path);
+
+        pthread_mutex_lock(&p->mutex);
+        c->state = AUDIOPREROLL_FREE;
+    }
+    pthread_mutex_unlock(&p->mutex);
+    return NULL;
+}
+void AudioPreroll_Start(AudioPreroll* p){
+    if(p->running){
+        printf("[AudioPreroll]: Start -> can't start because its already running!\n");
+        return;
+    }
+    pthread_mutex_init(&p->mutex,NULL);
+    pthread_cond_init(&p->cond,NULL);
+    p->running = 1;
+    p->writing = 1;
+    p->writer = Thread_New(NULL,(void*)AudioPreroll_Writer,p);
+    Thread_Start(&p->writer);
+    p->thread = Thread_New(NULL,(void*)AudioPreroll_Execute,p);
+    Thread_Start(&p->thread);
+}
+// a clip that is still recording gets written with what it has so far
+void AudioPreroll_Stop(AudioPreroll* p){
+    if(!p->running){
+        printf("[AudioPreroll]: Stop -> can't stop because it already stopped!\n");
+        return;
+    }
+    p->running = 0;
+    Thread_Join(&p->thread,NULL);
+
+    pthread_mutex_lock(&p->mutex);
+    p->writing = 0;
+    pthread_cond_broadcast(&p->cond);
+    pthread_mutex_unlock(&p->mutex);
+    Thread_Join(&p->writer,NULL);
+
+    pthread_mutex_destroy(&p->mutex);
+    pthread_cond_destroy(&p->cond);
+}
+void AudioPreroll_Free(AudioPreroll* p){
+    if(p->pcm_handle) p->backend.close(p->pcm_handle);
+    if(p->ring) free(p->ring);
+    for(int i = 0;i<AUDIOPREROLL_CLIPS;i++)
+        if(p->clips[i].Memory) free(p->clips[i].Memory);
+    *p = AudioPreroll_Null();
+}
+
+#endif//!AUDIOPREROLL_H
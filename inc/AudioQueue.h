@@ -0,0 +1,226 @@
+#ifndef AUDIOQUEUE_H
+#define AUDIOQUEUE_H
+
+#include "Audio.h"
+
+#define AUDIOQUEUE_PREFETCH     1
+
+#define AUDIOQUEUE_PENDING      0
+#define AUDIOQUEUE_LOADING      1
+#define AUDIOQUEUE_READY        2
+#define AUDIOQUEUE_DONE         3
+#define AUDIOQUEUE_FAILED       4
+
+typedef struct AudioQueueItem{
+    char* Path;
+    WavFile wf;
+    size_t frames;
+    char state;
+} AudioQueueItem;
+
+typedef struct AudioQueue{
+    OAudio* out;
+    Thread thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    char running;
+    DataStream items;
+    int count;
+    int current;
+    char* period;
+    size_t fill;
+    size_t position;
+    size_t seek;
+    char seeking;
+    size_t loop_start;
+    size_t loop_end;
+    int loops;
+} AudioQueue;
+
+AudioQueueItem* AudioQueue_Item(AudioQueue* q,int i){
+    return ((AudioQueueItem*)q->items.Memory) + i;
+}
+WavFile AudioQueue_Decode(AudioQueue* q,char* Path){
+    return OAudio_Decode(q->out,Path);
+}
+// background thread: decodes the current and the next AUDIOQUEUE_PREFETCH items while the current one plays
+void* AudioQueue_Prefetch(AudioQueue* q){
+    pthread_mutex_lock(&q->mutex);
+    while(q->running){
+        int next = -1;
+        for(int i = q->current;i<q->count && i<=q->current + AUDIOQUEUE_PREFETCH;i++){
+            if(AudioQueue_Item(q,i)->state==AUDIOQUEUE_PENDING){
+                next = i;
+                break;
+            }
+        }
+        if(next<0){
+            pthread_cond_wait(&q->cond,&q->mutex);
+            continue;
+        }
+
+        char* Path = AudioQueue_Item(q,next)->Path;
+        AudioQueue_Item(q,next)->state = AUDIOQUEUE_LOADING;
+        pthread_mutex_unlock(&q->mutex);
+
+        WavFile wf = AudioQueue_Decode(q,Path);
+
+        pthread_mutex_lock(&q->mutex);
+        AudioQueueItem* item = AudioQueue_Item(q,next);
+        item->wf = wf;
+        item->frames = wf.buffer ? wf.dataSize / q->out->bytes_per_frame : 0;
+        item->state = wf.buffer ? AUDIOQUEUE_READY : AUDIOQUEUE_FAILED;
+        pthread_cond_broadcast(&q->cond);
+    }
+    pthread_mutex_unlock(&q->mutex);
+    return NULL;
+}
+
+AudioQueue AudioQueue_New(OAudio* out){
+    AudioQueue q;
+    q.out = out;
+    q.running = 0;
+    q.items = DataStream_New();
+    q.count = 0;
+    q.current = 0;
+    q.period = malloc(out->frames * out->bytes_per_frame);
+    q.fill = 0;
+    q.position = 0;
+    q.seek = 0;
+    q.seeking = 0;
+    q.loop_start = 0;
+    q.loop_end = 0;
+    q.loops = 0;
+    q.thread = Thread_Null();
+    return q;
+}
+// sets up the lock on the callers queue and starts the prefetch thread, Push, Seek, Loop and Play do it on first use
+void AudioQueue_Start(AudioQueue* q){
+    if(q->running) return;
+    pthread_mutex_init(&q->mutex,NULL);
+    pthread_cond_init(&q->cond,NULL);
+    q->running = 1;
+    q->thread = Thread_New(NULL,(void*)AudioQueue_Prefetch,q);
+    Thread_Start(&q->thread);
+}
+void AudioQueue_Push(AudioQueue* q,char* Path){
+    AudioQueueItem item;
+    item.Path = strdup(Path);
+    item.wf = WavFile_Null();
+    item.frames = 0;
+    item.state = AUDIOQUEUE_PENDING;
+
+    AudioQueue_Start(q);
+    pthread_mutex_lock(&q->mutex);
+    DataStream_PushCount(&q->items,&item,sizeof(AudioQueueItem));
+    q->count++;
+    pthread_cond_broadcast(&q->cond);
+    pthread_mutex_unlock(&q->mutex);
+}
+// jumps to frame of the current item, the next frame that gets spliced into the output is exactly that one
+void AudioQueue_Seek(AudioQueue* q,size_t frame){
+    AudioQueue_Start(q);
+    pthread_mutex_lock(&q->mutex);
+    q->seek = frame;
+    q->seeking = 1;
+    pthread_mutex_unlock(&q->mutex);
+}
+// repeats [start,end) of the current item count times (-1 forever, 0 disables the loop)
+void AudioQueue_Loop(AudioQueue* q,size_t start,size_t end,int count){
+    AudioQueue_Start(q);
+    pthread_mutex_lock(&q->mutex);
+    if(end<=start) count = 0;
+    q->loop_start = start;
+    q->loop_end = end;
+    q->loops = count;
+    pthread_mutex_unlock(&q->mutex);
+}
+void AudioQueue_Flush(AudioQueue* q){
+    if(q->fill==0) return;
+    OAudio_WriteFrames(q->out,q->period,q->fill);
+    q->fill = 0;
+}
+// plays all pushed items back to back on the open output, only full periods are handed to the device
+void AudioQueue_Play(AudioQueue* q){
+    size_t bpf = q->out->bytes_per_frame;
+
+    AudioQueue_Start(q);
+    pthread_mutex_lock(&q->mutex);
+    while(q->current < q->count){
+        AudioQueueItem* item = AudioQueue_Item(q,q->current);
+        while(item->state==AUDIOQUEUE_PENDING || item->state==AUDIOQUEUE_LOADING){
+            pthread_cond_wait(&q->cond,&q->mutex);
+            item = AudioQueue_Item(q,q->current);
+        }
+
+        if(item->state==AUDIOQUEUE_READY){
+            char* data = item->wf.buffer;
+            size_t frames = item->frames;
+            q->position = 0;
+
+            while(q->position < frames){
+                if(q->seeking){
+                    q->position = q->seek < frames ? q->seek : frames;
+                    q->seeking = 0;
+                }
+
+                size_t end = frames;
+                if(q->loops!=0 && q->loop_end<=frames && q->position<q->loop_end) end = q->loop_end;
+
+                size_t n = q->out->frames - q->fill;
+                if(n > end - q->position) n = end - q->position;
+                pthread_mutex_unlock(&q->mutex);
+
+                memcpy(q->period + q->fill * bpf,data + q->position * bpf,n * bpf);
+                q->fill += n;
+                if(q->fill==q->out->frames){
+                    OAudio_WriteFrames(q->out,q->period,q->fill);
+                    q->fill = 0;
+                }
+
+                pthread_mutex_lock(&q->mutex);
+                q->position += n;
+                if(q->position==q->loop_end && q->loops!=0 && !q->seeking){
+                    q->position = q->loop_start;
+                    if(q->loops>0) q->loops--;
+                }
+            }
+        }
+
+        item = AudioQueue_Item(q,q->current);
+        WavFile_Free(&item->wf);
+        free(item->Path);
+        item->Path = NULL;
+        item->state = AUDIOQUEUE_DONE;
+
+        q->current++;
+        q->seeking = 0;
+        q->loops = 0;
+        pthread_cond_broadcast(&q->cond);
+    }
+    pthread_mutex_unlock(&q->mutex);
+
+    AudioQueue_Flush(q);
+}
+void AudioQueue_Free(AudioQueue* q){
+    if(q->running){
+        pthread_mutex_lock(&q->mutex);
+        q->running = 0;
+        pthread_cond_broadcast(&q->cond);
+        pthread_mutex_unlock(&q->mutex);
+        Thread_Join(&q->thread,NULL);
+        pthread_mutex_destroy(&q->mutex);
+        pthread_cond_destroy(&q->cond);
+    }
+
+    for(int i = 0;i<q->count;i++){
+        AudioQueueItem* item = AudioQueue_Item(q,i);
+        if(item->state!=AUDIOQUEUE_DONE) WavFile_Free(&item->wf);
+        if(item->Path) free(item->Path);
+    }
+    DataStream_Free(&q->items);
+    if(q->period) free(q->period);
+    q->period = NULL;
+}
+
+#endif//!AUDIOQUEUE_H
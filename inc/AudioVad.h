@@ -0,0 +1,150 @@
+#ifndef AUDIOVAD_H
+#define AUDIOVAD_H
+
+#include "AlxTime.h"
+#include "DataStream.h"
+
+#include <stdint.h>
+#include <math.h>
+
+typedef struct AudioVadSegment{
+    Timepoint start;    // nanoseconds since capture start, pre-roll included
+    Timepoint end;
+    int offset;         // bytes into the capture buffer
+    int size;
+} AudioVadSegment;
+
+typedef struct AudioVad{
+    char enabled;
+    char active;
+    long long energy;   // mean square threshold in int16 units
+    int zcr;            // zero crossings per 1000 samples that still count as unvoiced speech
+    int hangover;       // periods stored after the last active one
+    int preroll;        // periods stored before the first active one
+    int hold;
+    int period_bytes;
+    char* ring;
+    Timepoint* ring_time;
+    int ring_head;
+    int ring_count;
+    unsigned long long frames;  // captured since the start, segment times are derived from it
+    DataStream segments;
+    unsigned long long bytes_in;
+    unsigned long long bytes_dropped;
+} AudioVad;
+
+AudioVad AudioVad_Null(){
+    AudioVad v;
+    memset(&v,0,sizeof(AudioVad));
+    v.segments = DataStream_Null();
+    return v;
+}
+// threshold in dBFS, hangover and preroll in periods
+AudioVad AudioVad_New(int period_bytes,float threshold,int zcr,int hangover,int preroll){
+    AudioVad v = AudioVad_Null();
+    double amp = 32767.0 * pow(10.0,threshold / 20.0);
+    v.enabled = 1;
+    v.energy = (long long)(amp * amp);
+    v.zcr = zcr;
+    v.hangover = hangover;
+    v.preroll = preroll;
+    v.period_bytes = period_bytes;
+    v.ring = preroll > 0 ? malloc(preroll * period_bytes) : NULL;
+    v.ring_time = preroll > 0 ? malloc(preroll * sizeof(Timepoint)) : NULL;
+    v.segments = DataStream_New();
+    return v;
+}
+// one pass over the period, written branch free so it vectorizes (interleaved channels count as one signal)
+char AudioVad_Detect(AudioVad* v,int16_t* samples,int count){
+    if(count<2) return 0;
+
+    long long sum = 0;
+    int crossings = 0;
+    for(int i = 0;i<count;i++)
+        sum += (int)samples[i] * (int)samples[i];
+    for(int i = 1;i<count;i++)
+        crossings += ((samples[i] ^ samples[i - 1]) >> 15) & 1;
+
+    long long energy = sum / count;
+    if(energy >= v->energy) return 1;
+    return energy * 4 >= v->energy && crossings * 1000 >= v->zcr * count;
+}
+AudioVadSegment* AudioVad_Last(AudioVad* v){
+    return ((AudioVadSegment*)v->segments.Memory) + (v->segments.size / sizeof(AudioVadSegment) - 1);
+}
+int AudioVad_Count(AudioVad* v){
+    if(!v->segments.Memory) return 0;
+    return v->segments.size / sizeof(AudioVadSegment);
+}
+// stores the period into out only while speech (plus pre-roll and hangover) is going on, start/end in ns since capture start
+void AudioVad_Feed(AudioVad* v,DataStream* out,int16_t* samples,int bytes,Timepoint start,Timepoint end){
+    v->bytes_in += bytes;
+
+    if(AudioVad_Detect(v,samples,bytes / sizeof(int16_t))){
+        if(!v->active){
+            AudioVadSegment s;
+            s.start = start;
+            s.offset = out->size;
+            s.size = 0;
+
+            int first = (v->ring_head - v->ring_count + v->preroll) % (v->preroll ? v->preroll : 1);
+            for(int i = 0;i<v->ring_count;i++){
+                int slot = (first + i) % v->preroll;
+                if(i==0) s.start = v->ring_time[slot];
+                DataStream_PushCount(out,v->ring + slot * v->period_bytes,v->period_bytes);
+            }
+            v->bytes_dropped -= (unsigned long long)v->ring_count * v->period_bytes;
+            v->ring_count = 0;
+
+            DataStream_PushCount(&v->segments,&s,sizeof(AudioVadSegment));
+            v->active = 1;
+        }
+        v->hold = v->hangover;
+    }else if(v->active){
+        if(v->hold-- <= 0) v->active = 0;
+    }
+
+    if(v->active){
+        DataStream_PushCount(out,samples,bytes);
+        AudioVadSegment* s = AudioVad_Last(v);
+        s->end = end;
+        s->size = out->size - s->offset;
+    }else{
+        v->bytes_dropped += bytes;
+        if(v->preroll > 0 && bytes==v->period_bytes){
+            memcpy(v->ring + v->ring_head * v->period_bytes,samples,bytes);
+            v->ring_time[v->ring_head] = start;
+            v->ring_head = (v->ring_head + 1) % v->preroll;
+            if(v->ring_count < v->preroll) v->ring_count++;
+        }
+    }
+}
+void AudioVad_Clear(AudioVad* v){
+    if(v->segments.Memory) DataStream_Clear(&v->segments);
+    v->active = 0;
+    v->hold = 0;
+    v->ring_count = 0;
+    v->frames = 0;
+    v->bytes_in = 0;
+    v->bytes_dropped = 0;
+}
+void AudioVad_Print(AudioVad* v){
+    double ratio = v->bytes_in ? 100.0 * v->bytes_dropped / v->bytes_in : 0.0;
+    printf("--- AudioVad ---\n");
+    printf("Segments: %d\n",AudioVad_Count(v));
+    printf("Captured: %llu bytes\n",v->bytes_in);
+    printf("Dropped: %llu bytes (%.1f%%)\n",v->bytes_dropped,ratio);
+    for(int i = 0;i<AudioVad_Count(v);i++){
+        AudioVadSegment* s = ((AudioVadSegment*)v->segments.Memory) + i;
+        printf("[%d]: %.3fs - %.3fs\n",i,Time_NanoToSec(s->start),Time_NanoToSec(s->end));
+    }
+    printf("--------------\n");
+}
+void AudioVad_Free(AudioVad* v){
+    if(v->ring) free(v->ring);
+    if(v->ring_time) free(v->ring_time);
+    if(v->segments.Memory) DataStream_Free(&v->segments);
+    *v = AudioVad_Null();
+}
+
+#endif//!AUDIOVAD_H
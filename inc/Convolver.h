@@ -0,0 +1,330 @@
+#ifndef CONVOLVER_H
+#define CONVOLVER_H
+
+#include "Audio.h"
+
+#include <math.h>
+
+typedef struct ConvolverFFT{
+    int n;
+    int* rev;
+    float* cos;
+    float* sin;
+} ConvolverFFT;
+
+struct Convolver;
+
+typedef struct ConvolverWorker{
+    struct Convolver* c;
+    Thread thread;
+    int p0;
+    int p1;
+    float* re;
+    float* im;
+} ConvolverWorker;
+
+// uniformly partitioned overlap-save convolution, latency is one block
+typedef struct Convolver{
+    int block;
+    int size;
+    int bins;
+    int parts;
+    ConvolverFFT fft;
+    float* ir_re;
+    float* ir_im;
+    float* fdl_re;
+    float* fdl_im;
+    int head;
+    int tail;
+    float* input;
+    float* acc_re;
+    float* acc_im;
+    float* work_re;
+    float* work_im;
+    float* scratch;
+    int threads;
+    ConvolverWorker* workers;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    unsigned int generation;
+    int pending;
+    char running;
+} Convolver;
+
+ConvolverFFT ConvolverFFT_New(int n){
+    ConvolverFFT f;
+    f.n = n;
+    f.rev = malloc(n * sizeof(int));
+    f.cos = malloc(n / 2 * sizeof(float));
+    f.sin = malloc(n / 2 * sizeof(float));
+
+    int bits = 0;
+    while((1 << bits) < n) bits++;
+    for(int i = 0;i<n;i++){
+        int r = 0;
+        for(int b = 0;b<bits;b++) r |= ((i >> b) & 1) << (bits - 1 - b);
+        f.rev[i] = r;
+    }
+    for(int i = 0;i<n / 2;i++){
+        f.cos[i] = cos(2.0 * M_PI * i / n);
+        f.sin[i] = sin(2.0 * M_PI * i / n);
+    }
+    return f;
+}
+// in place radix-2, the inverse is not scaled
+void ConvolverFFT_Run(ConvolverFFT* f,float* re,float* im,int inverse){
+    int n = f->n;
+    for(int i = 0;i<n;i++){
+        int j = f->rev[i];
+        if(i<j){
+            float t = re[i]; re[i] = re[j]; re[j] = t;
+            t = im[i]; im[i] = im[j]; im[j] = t;
+        }
+    }
+    float sign = inverse ? 1.0f : -1.0f;
+    for(int len = 2;len<=n;len <<= 1){
+        int half = len >> 1;
+        int step = n / len;
+        for(int i = 0;i<n;i += len){
+            for(int j = 0;j<half;j++){
+                float wr = f->cos[j * step];
+                float wi = sign * f->sin[j * step];
+                int a = i + j;
+                int b = a + half;
+                float xr = re[b] * wr - im[b] * wi;
+                float xi = re[b] * wi + im[b] * wr;
+                re[b] = re[a] - xr;
+                im[b] = im[a] - xi;
+                re[a] += xr;
+                im[a] += xi;
+            }
+        }
+    }
+}
+void ConvolverFFT_Free(ConvolverFFT* f){
+    if(f->rev) free(f->rev);
+    if(f->cos) free(f->cos);
+    if(f->sin) free(f->sin);
+    f->rev = NULL;
+    f->cos = NULL;
+    f->sin = NULL;
+}
+
+// acc += sum of input spectrum (k - p) * ir partition p for p in [p0,p1), head is the slot of spectrum k
+void Convolver_Accumulate(Convolver* c,float* acc_re,float* acc_im,int p0,int p1,int head){
+    int bins = c->bins;
+    for(int p = p0;p<p1;p++){
+        int slot = (head + p) % c->parts;
+        float* xr = c->fdl_re + slot * bins;
+        float* xi = c->fdl_im + slot * bins;
+        float* hr = c->ir_re + p * bins;
+        float* hi = c->ir_im + p * bins;
+        for(int k = 0;k<bins;k++){
+            acc_re[k] += xr[k] * hr[k] - xi[k] * hi[k];
+            acc_im[k] += xr[k] * hi[k] + xi[k] * hr[k];
+        }
+    }
+}
+// tail partitions for the next block only depend on past input, so workers compute them while the device plays
+void* Convolver_Worker(ConvolverWorker* w){
+    Convolver* c = w->c;
+    unsigned int seen = 0;
+
+    pthread_mutex_lock(&c->mutex);
+    while(1){
+        while(c->running && c->generation==seen) pthread_cond_wait(&c->cond,&c->mutex);
+        if(!c->running) break;
+        seen = c->generation;
+        pthread_mutex_unlock(&c->mutex);
+
+        memset(w->re,0,c->bins * sizeof(float));
+        memset(w->im,0,c->bins * sizeof(float));
+        Convolver_Accumulate(c,w->re,w->im,w->p0,w->p1,c->tail);
+
+        pthread_mutex_lock(&c->mutex);
+        if(--c->pending==0) pthread_cond_broadcast(&c->cond);
+    }
+    pthread_mutex_unlock(&c->mutex);
+    return NULL;
+}
+
+Convolver Convolver_Null(){
+    Convolver c;
+    memset(&c,0,sizeof(Convolver));
+    return c;
+}
+// block has to be a power of two (the period size), threads > 0 moves the tail partitions onto worker threads
+Convolver Convolver_New(float* ir,int length,int block,int threads){
+    Convolver c = Convolver_Null();
+    if(block<=0 || (block & (block - 1))!=0){
+        printf("[Convolver]: New -> block size %d is no power of two!\n",block);
+        return Convolver_Null();
+    }
+    if(length<=0){
+        printf("[Convolver]: New -> impulse response is empty!\n");
+        return Convolver_Null();
+    }
+
+    c.block = block;
+    c.size = block * 2;
+    c.bins = block + 1;
+    c.parts = (length + block - 1) / block;
+    c.fft = ConvolverFFT_New(c.size);
+    c.ir_re = calloc(c.parts * c.bins,sizeof(float));
+    c.ir_im = calloc(c.parts * c.bins,sizeof(float));
+    c.fdl_re = calloc(c.parts * c.bins,sizeof(float));
+    c.fdl_im = calloc(c.parts * c.bins,sizeof(float));
+    c.input = calloc(c.size,sizeof(float));
+    c.acc_re = calloc(c.bins,sizeof(float));
+    c.acc_im = calloc(c.bins,sizeof(float));
+    c.work_re = calloc(c.size,sizeof(float));
+    c.work_im = calloc(c.size,sizeof(float));
+    c.scratch = calloc(block,sizeof(float));
+    c.head = 0;
+
+    // partition p holds ir[p*B,(p+1)*B) zero padded to 2B, scaled for the unscaled inverse
+    for(int p = 0;p<c.parts;p++){
+        memset(c.work_re,0,c.size * sizeof(float));
+        memset(c.work_im,0,c.size * sizeof(float));
+        for(int i = 0;i<block && p * block + i<length;i++) c.work_re[i] = ir[p * block + i] / c.size;
+        ConvolverFFT_Run(&c.fft,c.work_re,c.work_im,0);
+        memcpy(c.ir_re + p * c.bins,c.work_re,c.bins * sizeof(float));
+        memcpy(c.ir_im + p * c.bins,c.work_im,c.bins * sizeof(float));
+    }
+
+    if(threads > c.parts - 1) threads = c.parts - 1;
+    c.threads = threads > 0 ? threads : 0;
+    c.workers = NULL;
+    c.generation = 0;
+    c.pending = 0;
+    c.running = 0;
+    return c;
+}
+// loads channel of the impulse response through the wav reader
+Convolver Convolver_Load(char* Path,int channel,int block,int threads){
+    WavFile wf = WavFile_Read(Path,1);
+    if(!wf.buffer || wf.fmtChunk.numChannels==0) return Convolver_Null();
+
+    int length = WavFile_Frames(&wf);
+    float* ir = malloc(length * sizeof(float));
+    for(int i = 0;i<length;i++) ir[i] = WavFile_Get(&wf,i,channel % wf.fmtChunk.numChannels);
+
+    Convolver c = Convolver_New(ir,length,block,threads);
+    free(ir);
+    WavFile_Free(&wf);
+    return c;
+}
+// starts the workers, c must not move in memory afterwards
+void Convolver_Start(Convolver* c){
+    if(c->threads==0 || c->workers) return;
+
+    pthread_mutex_init(&c->mutex,NULL);
+    pthread_cond_init(&c->cond,NULL);
+    c->running = 1;
+    c->workers = malloc(c->threads * sizeof(ConvolverWorker));
+    for(int i = 0;i<c->threads;i++){
+        ConvolverWorker* w = c->workers + i;
+        w->c = c;
+        w->p0 = 1 + (c->parts - 1) * i / c->threads;
+        w->p1 = 1 + (c->parts - 1) * (i + 1) / c->threads;
+        w->re = calloc(c->bins,sizeof(float));
+        w->im = calloc(c->bins,sizeof(float));
+        w->thread = Thread_New(NULL,(void*)Convolver_Worker,w);
+        Thread_Start(&w->thread);
+    }
+}
+// convolves exactly one block of input, out may alias in
+void Convolver_Process(Convolver* c,float* in,float* out){
+    int B = c->block;
+    memmove(c->input,c->input + B,B * sizeof(float));
+    memcpy(c->input + B,in,B * sizeof(float));
+
+    memcpy(c->work_re,c->input,c->size * sizeof(float));
+    memset(c->work_im,0,c->size * sizeof(float));
+    ConvolverFFT_Run(&c->fft,c->work_re,c->work_im,0);
+
+    c->head = (c->head + c->parts - 1) % c->parts;
+    memcpy(c->fdl_re + c->head * c->bins,c->work_re,c->bins * sizeof(float));
+    memcpy(c->fdl_im + c->head * c->bins,c->work_im,c->bins * sizeof(float));
+
+    memset(c->acc_re,0,c->bins * sizeof(float));
+    memset(c->acc_im,0,c->bins * sizeof(float));
+    if(c->workers){
+        pthread_mutex_lock(&c->mutex);
+        while(c->pending>0) pthread_cond_wait(&c->cond,&c->mutex);
+        pthread_mutex_unlock(&c->mutex);
+
+        // the first block has no tail yet, the workers only ever ran on a silent delay line before
+        if(c->generation>0){
+            for(int i = 0;i<c->threads;i++){
+                for(int k = 0;k<c->bins;k++){
+                    c->acc_re[k] += c->workers[i].re[k];
+                    c->acc_im[k] += c->workers[i].im[k];
+                }
+            }
+        }
+        Convolver_Accumulate(c,c->acc_re,c->acc_im,0,1,c->head);
+    }else{
+        Convolver_Accumulate(c,c->acc_re,c->acc_im,0,c->parts,c->head);
+    }
+
+    // rebuild the conjugate symmetric spectrum of the real output
+    memcpy(c->work_re,c->acc_re,c->bins * sizeof(float));
+    memcpy(c->work_im,c->acc_im,c->bins * sizeof(float));
+    for(int k = 1;k<B;k++){
+        c->work_re[c->size - k] = c->acc_re[k];
+        c->work_im[c->size - k] = -c->acc_im[k];
+    }
+    ConvolverFFT_Run(&c->fft,c->work_re,c->work_im,1);
+    memcpy(out,c->work_re + B,B * sizeof(float));
+
+    if(c->workers){
+        pthread_mutex_lock(&c->mutex);
+        c->tail = (c->head + c->parts - 1) % c->parts;
+        c->pending = c->threads;
+        c->generation++;
+        pthread_cond_broadcast(&c->cond);
+        pthread_mutex_unlock(&c->mutex);
+    }
+}
+// convolves channel of one period of interleaved samples in place
+void Convolver_ProcessInterleaved(Convolver* c,AudioSample* buffer,int channels,int channel){
+    for(int i = 0;i<c->block;i++) c->scratch[i] = buffer[i * channels + channel] / 32768.0f;
+    Convolver_Process(c,c->scratch,c->scratch);
+    for(int i = 0;i<c->block;i++){
+        float v = c->scratch[i] * 32768.0f;
+        if(v > 32767.0f) v = 32767.0f;
+        if(v < -32768.0f) v = -32768.0f;
+        buffer[i * channels + channel] = (AudioSample)lrintf(v);
+    }
+}
+void Convolver_Free(Convolver* c){
+    if(c->workers){
+        pthread_mutex_lock(&c->mutex);
+        c->running = 0;
+        pthread_cond_broadcast(&c->cond);
+        pthread_mutex_unlock(&c->mutex);
+        for(int i = 0;i<c->threads;i++){
+            Thread_Join(&c->workers[i].thread,NULL);
+            free(c->workers[i].re);
+            free(c->workers[i].im);
+        }
+        free(c->workers);
+        pthread_mutex_destroy(&c->mutex);
+        pthread_cond_destroy(&c->cond);
+    }
+    ConvolverFFT_Free(&c->fft);
+    if(c->ir_re) free(c->ir_re);
+    if(c->ir_im) free(c->ir_im);
+    if(c->fdl_re) free(c->fdl_re);
+    if(c->fdl_im) free(c->fdl_im);
+    if(c->input) free(c->input);
+    if(c->acc_re) free(c->acc_re);
+    if(c->acc_im) free(c->acc_im);
+    if(c->work_re) free(c->work_re);
+    if(c->work_im) free(c->work_im);
+    if(c->scratch) free(c->scratch);
+    *c = Convolver_Null();
+}
+
+#endif//!CONVOLVER_H
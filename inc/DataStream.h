@@ -97,7 +97,7 @@ void DataStream_Move(DataStream* v, unsigned int Index, int Count) {
     }
 }
 void DataStream_PushCount(DataStream* v, void* Items, int Count) {
-    DataStream_ExpandBy(v,Count);
+    if (v->size + Count >= v->SIZE) DataStream_ExpandTo(v,(v->size + Count) * 2);
     if (v->size < v->SIZE){
         memcpy((char*)v->Memory + v->size,Items,Count);
         v->size += Count;
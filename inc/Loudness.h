@@ -0,0 +1,445 @@
+#ifndef LOUDNESS_H
+#define LOUDNESS_H
+
+#include "Audio.h"
+
+#include <math.h>
+#include <float.h>
+
+#define LOUDNESS_GATE_ABS       -70.0
+#define LOUDNESS_GATE_REL       -10.0
+#define LOUDNESS_BIN_MIN        -70.0
+#define LOUDNESS_BIN_STEP       0.01
+#define LOUDNESS_BINS           8000
+#define LOUDNESS_MAX_CHANNELS   8
+#define LOUDNESS_TP_FACTOR      4
+#define LOUDNESS_TP_TAPS        12
+#define LOUDNESS_HOPS_BLOCK     4       // 400 ms momentary block out of 100 ms hops
+#define LOUDNESS_HOPS_SHORT     30      // 3 s short-term window
+#define LOUDNESS_SILENCE        -HUGE_VAL
+#define LOUDNESS_BLOCK          4096    // frames converted to float at once
+
+typedef struct Loudness{
+    double integrated;      // LUFS
+    double momentary;       // max LUFS over all 400 ms blocks
+    double shortterm;       // max LUFS over all 3 s windows
+    double truepeak;        // dBTP
+    double samplepeak;      // dBFS
+    double duration;        // seconds of audio
+    double elapsed;         // seconds spent measuring
+} Loudness;
+
+// gating histogram: 0.01 LU bins from -70 LUFS upwards, with the block energies so merging stays exact
+typedef struct LoudnessHistogram{
+    unsigned int count[LOUDNESS_BINS];
+    double energy[LOUDNESS_BINS];
+} LoudnessHistogram;
+
+typedef struct LoudnessBiquad{
+    double b0,b1,b2,a1,a2;
+} LoudnessBiquad;
+
+typedef struct LoudnessChunk{
+    WavFile* wf;
+    size_t hop;
+    size_t hops;
+    size_t h0;
+    size_t h1;
+    LoudnessBiquad shelf;
+    LoudnessBiquad highpass;
+    float* taps;
+    LoudnessHistogram* hist;
+    double momentary;
+    double shortterm;
+    double truepeak;
+    double samplepeak;
+} LoudnessChunk;
+
+double Loudness_LUFS(double energy){
+    return energy > 0.0 ? -0.691 + 10.0 * log10(energy) : LOUDNESS_SILENCE;
+}
+double Loudness_Energy(double lufs){
+    return pow(10.0,(lufs + 0.691) / 10.0);
+}
+// ITU-R BS.1770 K-weighting, recalculated for any sample rate
+void Loudness_KWeighting(double rate,LoudnessBiquad* shelf,LoudnessBiquad* highpass){
+    double f0 = 1681.974450955533;
+    double G = 3.999843853973347;
+    double Q = 0.7071752369554196;
+    double K = tan(M_PI * f0 / rate);
+    double Vh = pow(10.0,G / 20.0);
+    double Vb = pow(Vh,0.4996667741545416);
+    double a0 = 1.0 + K / Q + K * K;
+    shelf->b0 = (Vh + Vb * K / Q + K * K) / a0;
+    shelf->b1 = 2.0 * (K * K - Vh) / a0;
+    shelf->b2 = (Vh - Vb * K / Q + K * K) / a0;
+    shelf->a1 = 2.0 * (K * K - 1.0) / a0;
+    shelf->a2 = (1.0 - K / Q + K * K) / a0;
+
+    f0 = 38.13547087602444;
+    Q = 0.5003270373238773;
+    K = tan(M_PI * f0 / rate);
+    a0 = 1.0 + K / Q + K * K;
+    highpass->b0 = 1.0;
+    highpass->b1 = -2.0;
+    highpass->b2 = 1.0;
+    highpass->a1 = 2.0 * (K * K - 1.0) / a0;
+    highpass->a2 = (1.0 - K / Q + K * K) / a0;
+}
+double Loudness_Weight(int channel,int channels){
+    if(channels==6) return channel==3 ? 0.0 : (channel>=4 ? 1.41 : 1.0);
+    if(channels==5) return channel>=3 ? 1.41 : 1.0;
+    return 1.0;
+}
+// windowed sinc interpolator in its natural order, taps[t * LOUDNESS_TP_FACTOR + phase] weights the input t samples back,
+// so all phases of one tap are next to each other and get computed together
+float* Loudness_Taps(){
+    int n = LOUDNESS_TP_FACTOR * LOUDNESS_TP_TAPS;
+    float* taps = malloc(n * sizeof(float));
+    for(int i = 0;i<n;i++){
+        double x = (i - (n - 1) * 0.5) / LOUDNESS_TP_FACTOR;
+        double sinc = fabs(x) < 1e-9 ? 1.0 : sin(M_PI * x) / (M_PI * x);
+        double window = 0.5 - 0.5 * cos(2.0 * M_PI * (i + 0.5) / n);
+        taps[i] = sinc * window;
+    }
+    return taps;
+}
+void LoudnessHistogram_Add(LoudnessHistogram* h,double energy){
+    double lufs = Loudness_LUFS(energy);
+    if(lufs < LOUDNESS_GATE_ABS) return;
+    int bin = (int)((lufs - LOUDNESS_BIN_MIN) / LOUDNESS_BIN_STEP);
+    if(bin >= LOUDNESS_BINS) bin = LOUDNESS_BINS - 1;
+    h->count[bin]++;
+    h->energy[bin] += energy;
+}
+void LoudnessHistogram_Merge(LoudnessHistogram* dst,LoudnessHistogram* src){
+    for(int i = 0;i<LOUDNESS_BINS;i++){
+        dst->count[i] += src->count[i];
+        dst->energy[i] += src->energy[i];
+    }
+}
+double LoudnessHistogram_Integrated(LoudnessHistogram* h){
+    double sum = 0.0;
+    unsigned long long count = 0;
+    for(int i = 0;i<LOUDNESS_BINS;i++){
+        sum += h->energy[i];
+        count += h->count[i];
+    }
+    if(count==0) return LOUDNESS_SILENCE;
+
+    double gate = Loudness_LUFS(sum / count) + LOUDNESS_GATE_REL;
+    int first = (int)ceil((gate - LOUDNESS_BIN_MIN) / LOUDNESS_BIN_STEP);
+    if(first < 0) first = 0;
+
+    sum = 0.0;
+    count = 0;
+    for(int i = first;i<LOUDNESS_BINS;i++){
+        sum += h->energy[i];
+        count += h->count[i];
+    }
+    return count ? Loudness_LUFS(sum / count) : LOUDNESS_SILENCE;
+}
+
+// n frames from f0 as planar float, channel ch at out + ch * stride, the format is dispatched once per call instead of per sample
+void Loudness_Convert(WavFile* wf,size_t f0,size_t n,float* out,size_t stride){
+    int channels = wf->fmtChunk.numChannels;
+    int bytes = wf->fmtChunk.bitsPerSample / 8;
+    size_t align = wf->fmtChunk.blockAlign;
+    unsigned char* src = (unsigned char*)wf->buffer + f0 * align;
+
+    for(int ch = 0;ch<channels;ch++){
+        unsigned char* s = src + ch * bytes;
+        float* o = out + ch * stride;
+        if(wf->fmtChunk.audioFormat==3){
+            for(size_t f = 0;f<n;f++,s += align) memcpy(o + f,s,sizeof(float));
+            continue;
+        }
+        switch(bytes){
+            case 1:
+                for(size_t f = 0;f<n;f++,s += align) o[f] = ((int)s[0] - 128) / 128.0f;
+                break;
+            case 2:
+                for(size_t f = 0;f<n;f++,s += align) o[f] = (int16_t)(s[0] | (s[1] << 8)) / 32768.0f;
+                break;
+            case 3:
+                for(size_t f = 0;f<n;f++,s += align) o[f] = (int32_t)(((uint32_t)s[0] << 8) | ((uint32_t)s[1] << 16) | ((uint32_t)s[2] << 24)) / 2147483648.0f;
+                break;
+            case 4:
+                for(size_t f = 0;f<n;f++,s += align) o[f] = (int32_t)((uint32_t)s[0] | ((uint32_t)s[1] << 8) | ((uint32_t)s[2] << 16) | ((uint32_t)s[3] << 24)) / 2147483648.0f;
+                break;
+        }
+    }
+}
+// measures the blocks and windows that start in [h0,h1), reading ahead as far as they reach
+void* Loudness_Chunk(LoudnessChunk* c){
+    WavFile* wf = c->wf;
+    int channels = wf->fmtChunk.numChannels;
+    size_t frames = WavFile_Frames(wf);
+    size_t last = c->h1 + LOUDNESS_HOPS_SHORT - 1;
+    if(last > c->hops) last = c->hops;
+
+    // one second of filter warm-up before the chunk, so chunks match a single pass
+    size_t begin = c->h0 * c->hop;
+    size_t warm = begin > (size_t)wf->fmtChunk.sampleRate ? begin - wf->fmtChunk.sampleRate : 0;
+    size_t end = last * c->hop;
+    size_t peak_end = c->h1 * c->hop;
+    if(c->h1==c->hops) peak_end = frames;
+    if(end > frames) end = frames;
+    if(peak_end > frames) peak_end = frames;
+
+    int span = LOUDNESS_TP_TAPS;
+    double state[LOUDNESS_MAX_CHANNELS][4] = {0};
+    float history[LOUDNESS_MAX_CHANNELS][LOUDNESS_TP_TAPS * 2] = {0};
+    int pos = span;
+    double weight[LOUDNESS_MAX_CHANNELS];
+    for(int ch = 0;ch<channels;ch++) weight[ch] = Loudness_Weight(ch,channels);
+
+    size_t count = last - c->h0;
+    double* hops = calloc(count + 1,sizeof(double));
+    float* samples = malloc(LOUDNESS_BLOCK * channels * sizeof(float));
+    LoudnessBiquad s = c->shelf;
+    LoudnessBiquad p = c->highpass;
+    double sample_peak = 0.0;
+    double true_peak = 0.0;
+    double* hop = hops;
+    size_t hop_left = c->hop;
+
+    size_t tp_begin = begin > (size_t)span ? begin - span : 0;
+    size_t start = warm < tp_begin ? warm : tp_begin;
+    size_t stop = end > peak_end ? end : peak_end;
+    for(size_t b = start;b<stop;b += LOUDNESS_BLOCK){
+        size_t n = stop - b < LOUDNESS_BLOCK ? stop - b : LOUDNESS_BLOCK;
+        Loudness_Convert(wf,b,n,samples,LOUDNESS_BLOCK);
+
+        for(size_t i = 0;i<n;i++){
+            size_t f = b + i;
+            char peak = f>=begin && f<peak_end;
+            char filter = f>=warm && f<end;
+            double energy = 0.0;
+            // the history is mirrored, so the last span samples are always contiguous from pos
+            pos = pos==0 ? span - 1 : pos - 1;
+            for(int ch = 0;ch<channels;ch++){
+                float x = samples[ch * LOUDNESS_BLOCK + i];
+                history[ch][pos] = x;
+                history[ch][pos + span] = x;
+
+                if(peak){
+                    if(fabsf(x) > sample_peak) sample_peak = fabsf(x);
+                    float* window = history[ch] + pos;
+                    float y[LOUDNESS_TP_FACTOR] = {0};
+                    for(int t = 0;t<span;t++)
+                        for(int k = 0;k<LOUDNESS_TP_FACTOR;k++) y[k] += window[t] * c->taps[t * LOUDNESS_TP_FACTOR + k];
+                    for(int k = 0;k<LOUDNESS_TP_FACTOR;k++)
+                        if(fabsf(y[k]) > true_peak) true_peak = fabsf(y[k]);
+                }
+
+                if(!filter) continue;
+
+                double* z = state[ch];
+                double v = x - s.a1 * z[0] - s.a2 * z[1];
+                double y = s.b0 * v + s.b1 * z[0] + s.b2 * z[1];
+                z[1] = z[0];
+                z[0] = v;
+                double w = y - p.a1 * z[2] - p.a2 * z[3];
+                y = w - 2.0 * z[2] + z[3];
+                z[3] = z[2];
+                z[2] = w;
+                energy += weight[ch] * y * y;
+            }
+
+            // hops are consecutive from begin, counting down avoids a division per sample
+            if(filter && f >= begin){
+                *hop += energy;
+                if(--hop_left==0){
+                    hop++;
+                    hop_left = c->hop;
+                }
+            }
+        }
+    }
+    free(samples);
+
+    double block = (double)LOUDNESS_HOPS_BLOCK * c->hop;
+    double window = (double)LOUDNESS_HOPS_SHORT * c->hop;
+    for(size_t h = c->h0;h<c->h1;h++){
+        size_t i = h - c->h0;
+        if(h + LOUDNESS_HOPS_BLOCK <= c->hops){
+            double e = 0.0;
+            for(int k = 0;k<LOUDNESS_HOPS_BLOCK;k++) e += hops[i + k];
+            LoudnessHistogram_Add(c->hist,e / block);
+            double l = Loudness_LUFS(e / block);
+            if(l > c->momentary) c->momentary = l;
+        }
+        if(h + LOUDNESS_HOPS_SHORT <= c->hops){
+            double e = 0.0;
+            for(int k = 0;k<LOUDNESS_HOPS_SHORT;k++) e += hops[i + k];
+            double l = Loudness_LUFS(e / window);
+            if(l > c->shortterm) c->shortterm = l;
+        }
+    }
+
+    c->samplepeak = sample_peak;
+    c->truepeak = true_peak > sample_peak ? true_peak : sample_peak;
+    free(hops);
+    return NULL;
+}
+
+// EBU R128 measurement, the file is split into chunks measured on threads (0 = all cores)
+Loudness Loudness_Measure(WavFile* wf,int threads){
+    Loudness l;
+    l.integrated = LOUDNESS_SILENCE;
+    l.momentary = LOUDNESS_SILENCE;
+    l.shortterm = LOUDNESS_SILENCE;
+    l.truepeak = LOUDNESS_SILENCE;
+    l.samplepeak = LOUDNESS_SILENCE;
+    l.duration = 0.0;
+    l.elapsed = 0.0;
+
+    int channels = wf->fmtChunk.numChannels;
+    if(!wf->buffer || channels<=0 || channels>LOUDNESS_MAX_CHANNELS || wf->fmtChunk.sampleRate==0){
+        printf("[Loudness]: Measure -> unsupported audio file!\n");
+        return l;
+    }
+    int bits = wf->fmtChunk.bitsPerSample;
+    if(!(wf->fmtChunk.audioFormat==1 && bits>=8 && bits<=32 && bits % 8==0) && !(wf->fmtChunk.audioFormat==3 && bits==32)){
+        printf("[Loudness]: Measure -> only 8/16/24/32 bit pcm and 32 bit float are supported (format %d, %d bit)!\n",wf->fmtChunk.audioFormat,bits);
+        return l;
+    }
+
+    Timepoint start = Time_Nano();
+    size_t frames = WavFile_Frames(wf);
+    size_t hop = wf->fmtChunk.sampleRate / 10;
+    size_t hops = frames / hop;
+    l.duration = (double)frames / wf->fmtChunk.sampleRate;
+
+    if(threads<=0) threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if(threads<=0) threads = 1;
+    if((size_t)threads > hops / LOUDNESS_HOPS_SHORT) threads = hops / LOUDNESS_HOPS_SHORT;
+    if(threads<=0) threads = 1;
+
+    LoudnessBiquad shelf,highpass;
+    Loudness_KWeighting(wf->fmtChunk.sampleRate,&shelf,&highpass);
+    float* taps = Loudness_Taps();
+
+    LoudnessChunk* chunks = malloc(threads * sizeof(LoudnessChunk));
+    Thread* workers = malloc(threads * sizeof(Thread));
+    for(int i = 0;i<threads;i++){
+        LoudnessChunk* c = chunks + i;
+        c->wf = wf;
+        c->hop = hop;
+        c->hops = hops;
+        c->h0 = hops * i / threads;
+        c->h1 = hops * (i + 1) / threads;
+        c->shelf = shelf;
+        c->highpass = highpass;
+        c->taps = taps;
+        c->hist = calloc(1,sizeof(LoudnessHistogram));
+        c->momentary = LOUDNESS_SILENCE;
+        c->shortterm = LOUDNESS_SILENCE;
+        c->truepeak = 0.0;
+        c->samplepeak = 0.0;
+        workers[i] = Thread_New(NULL,(void*)Loudness_Chunk,c);
+        Thread_Start(workers + i);
+    }
+
+    double truepeak = 0.0;
+    double samplepeak = 0.0;
+    for(int i = 0;i<threads;i++){
+        LoudnessChunk* c = chunks + i;
+        Thread_Join(workers + i,NULL);
+        if(i>0) LoudnessHistogram_Merge(chunks[0].hist,c->hist);
+        if(c->momentary > l.momentary) l.momentary = c->momentary;
+        if(c->shortterm > l.shortterm) l.shortterm = c->shortterm;
+        if(c->truepeak > truepeak) truepeak = c->truepeak;
+        if(c->samplepeak > samplepeak) samplepeak = c->samplepeak;
+    }
+    l.integrated = LoudnessHistogram_Integrated(chunks[0].hist);
+    l.truepeak = truepeak > 0.0 ? 20.0 * log10(truepeak) : LOUDNESS_SILENCE;
+    l.samplepeak = samplepeak > 0.0 ? 20.0 * log10(samplepeak) : LOUDNESS_SILENCE;
+
+    for(int i = 0;i<threads;i++) free(chunks[i].hist);
+    free(chunks);
+    free(workers);
+    free(taps);
+
+    l.elapsed = Time_Elapsed(start,Time_Nano());
+    return l;
+}
+
+typedef struct LoudnessGain{
+    WavFile* wf;
+    size_t f0;
+    size_t f1;
+    float gain;
+} LoudnessGain;
+
+void* Loudness_GainChunk(LoudnessGain* g){
+    int channels = g->wf->fmtChunk.numChannels;
+    for(size_t f = g->f0;f<g->f1;f++)
+        for(int ch = 0;ch<channels;ch++)
+            WavFile_Set(g->wf,f,ch,WavFile_Get(g->wf,f,ch) * g->gain);
+    return NULL;
+}
+// scales wf in place to target LUFS without letting the true peak exceed ceiling dBTP
+Loudness Loudness_Normalize(WavFile* wf,double target,double ceiling,int threads){
+    Loudness l = Loudness_Measure(wf,threads);
+    if(l.integrated==LOUDNESS_SILENCE){
+        printf("[Loudness]: Normalize -> audio is silent, nothing to normalize!\n");
+        return l;
+    }
+
+    double gain = target - l.integrated;
+    if(l.truepeak + gain > ceiling) gain = ceiling - l.truepeak;
+
+    if(threads<=0) threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if(threads<=0) threads = 1;
+
+    size_t frames = WavFile_Frames(wf);
+    LoudnessGain* chunks = malloc(threads * sizeof(LoudnessGain));
+    Thread* workers = malloc(threads * sizeof(Thread));
+    for(int i = 0;i<threads;i++){
+        chunks[i].wf = wf;
+        chunks[i].f0 = frames * i / threads;
+        chunks[i].f1 = frames * (i + 1) / threads;
+        chunks[i].gain = pow(10.0,gain / 20.0);
+        workers[i] = Thread_New(NULL,(void*)Loudness_GainChunk,chunks + i);
+        Thread_Start(workers + i);
+    }
+    for(int i = 0;i<threads;i++) Thread_Join(workers + i,NULL);
+    free(chunks);
+    free(workers);
+
+    l.integrated += gain;
+    l.momentary += gain;
+    l.shortterm += gain;
+    l.truepeak += gain;
+    l.samplepeak += gain;
+    return l;
+}
+// reads Path, normalizes it and writes it back through the wav writer
+Loudness Loudness_NormalizeFile(char* Path,double target,double ceiling,int threads){
+    WavFile wf = WavFile_Read(Path,1);
+    Loudness l = Loudness_Normalize(&wf,target,ceiling,threads);
+
+    if(wf.buffer && l.integrated!=LOUDNESS_SILENCE){
+        int frame_size = wf.fmtChunk.blockAlign;
+        WavFile out = WavFile_Move(wf.fmtChunk.sampleRate,wf.fmtChunk.bitsPerSample,wf.fmtChunk.numChannels,wf.buffer,WavFile_Frames(&wf),frame_size);
+        out.fmtChunk.audioFormat = wf.fmtChunk.audioFormat;
+        WavFile_Write(&out,Path);
+    }
+
+    WavFile_Free(&wf);
+    return l;
+}
+void Loudness_Print(Loudness* l){
+    printf("--- Loudness ---\n");
+    printf("Integrated: %.2f LUFS\n",l->integrated);
+    printf("Momentary max: %.2f LUFS\n",l->momentary);
+    printf("Short-term max: %.2f LUFS\n",l->shortterm);
+    printf("True peak: %.2f dBTP\n",l->truepeak);
+    printf("Sample peak: %.2f dBFS\n",l->samplepeak);
+    if(l->elapsed > 0.0) printf("Speed: %.3f h of audio per s\n",l->duration / 3600.0 / l->elapsed);
+    printf("--------------\n");
+}
+
+#endif//!LOUDNESS_H
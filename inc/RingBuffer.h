@@ -0,0 +1,74 @@
+#ifndef RINGBUFFER_H
+#define RINGBUFFER_H
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+
+// lock-free single producer / single consumer byte ring, SIZE is rounded up to a power of two
+typedef struct RingBuffer {
+    size_t SIZE;
+    char* Memory;
+    _Atomic size_t head;    // written by the producer only
+    _Atomic size_t tail;    // written by the consumer only
+} RingBuffer;
+
+RingBuffer RingBuffer_Null(){
+    RingBuffer r;
+    r.SIZE = 0;
+    r.Memory = NULL;
+    atomic_init(&r.head,0);
+    atomic_init(&r.tail,0);
+    return r;
+}
+RingBuffer RingBuffer_New(size_t SIZE){
+    RingBuffer r = RingBuffer_Null();
+    size_t size = 1;
+    while(size < SIZE) size <<= 1;
+    r.SIZE = size;
+    r.Memory = malloc(size);
+    return r;
+}
+size_t RingBuffer_Size(RingBuffer* r){
+    return atomic_load_explicit(&r->head,memory_order_acquire) - atomic_load_explicit(&r->tail,memory_order_relaxed);
+}
+size_t RingBuffer_Space(RingBuffer* r){
+    return r->SIZE - (atomic_load_explicit(&r->head,memory_order_relaxed) - atomic_load_explicit(&r->tail,memory_order_acquire));
+}
+void RingBuffer_Copy(RingBuffer* r,size_t pos,void* Items,size_t Count,char out){
+    size_t offset = pos & (r->SIZE - 1);
+    size_t first = r->SIZE - offset < Count ? r->SIZE - offset : Count;
+    if(out){
+        memcpy(Items,r->Memory + offset,first);
+        memcpy((char*)Items + first,r->Memory,Count - first);
+    }else{
+        memcpy(r->Memory + offset,Items,first);
+        memcpy(r->Memory,(char*)Items + first,Count - first);
+    }
+}
+// all or nothing, returns 0 without waiting if there is not enough space
+char RingBuffer_Push(RingBuffer* r,void* Items,size_t Count){
+    if(RingBuffer_Space(r) < Count) return 0;
+    size_t head = atomic_load_explicit(&r->head,memory_order_relaxed);
+    RingBuffer_Copy(r,head,Items,Count,0);
+    atomic_store_explicit(&r->head,head + Count,memory_order_release);
+    return 1;
+}
+// copies Count bytes without consuming them, returns 0 if not enough are there
+char RingBuffer_Peek(RingBuffer* r,void* Items,size_t Count){
+    if(RingBuffer_Size(r) < Count) return 0;
+    RingBuffer_Copy(r,atomic_load_explicit(&r->tail,memory_order_relaxed),Items,Count,1);
+    return 1;
+}
+char RingBuffer_Pop(RingBuffer* r,void* Items,size_t Count){
+    if(!RingBuffer_Peek(r,Items,Count)) return 0;
+    atomic_fetch_add_explicit(&r->tail,Count,memory_order_release);
+    return 1;
+}
+void RingBuffer_Free(RingBuffer* r){
+    if(r->Memory) free(r->Memory);
+    *r = RingBuffer_Null();
+}
+
+#endif //!RINGBUFFER_H
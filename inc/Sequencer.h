@@ -0,0 +1,286 @@
+#ifndef SEQUENCER_H
+#define SEQUENCER_H
+
+#include "Audio.h"
+
+#include <stdatomic.h>
+
+#define SEQUENCER_VOICES        256
+
+typedef struct SequencerEvent{
+    unsigned long long time;    // sample time of the first frame
+    WavFile* sound;             // already in the output format, see OAudio_Decode
+    float gain;
+    unsigned long long order;   // post order, keeps events with the same time in sequence
+} SequencerEvent;
+
+typedef struct SequencerCell{
+    _Atomic size_t seq;
+    SequencerEvent event;
+} SequencerCell;
+
+typedef struct SequencerVoice{
+    AudioSample* data;
+    size_t frames;
+    size_t pos;
+    size_t offset;              // first frame inside the current period
+    float gain;
+} SequencerVoice;
+
+// renders events at their exact sample inside each period, posting is lock-free from any number of threads
+typedef struct Sequencer{
+    OAudio* out;
+    Thread thread;
+    char running;
+    SequencerCell* cells;       // bounded multi producer queue, only the audio thread takes from it
+    size_t mask;
+    _Atomic size_t enqueue;
+    size_t dequeue;
+    SequencerEvent* heap;       // min-heap on time, only touched by the audio thread
+    int heap_size;
+    int HEAP_SIZE;
+    SequencerVoice voices[SEQUENCER_VOICES];
+    int voice_count;
+    float* mix;
+    AudioSample* period;
+    _Atomic unsigned long long position;    // sample time of the next rendered frame
+    Timepoint origin;                       // output clock when sample time 0 was rendered
+    unsigned long long lookahead;           // frames added to monotonic timestamps
+    // stats
+    _Atomic unsigned long long posted;
+    _Atomic unsigned long long rejected;    // queue was full
+    unsigned long long processed;
+    unsigned long long late;
+    unsigned long long max_error;           // frames the latest event started after its time
+    unsigned long long stolen;
+    unsigned long long periods;
+    Duration render_time;
+} Sequencer;
+
+Sequencer Sequencer_Null(){
+    Sequencer s;
+    memset(&s,0,sizeof(Sequencer));
+    s.thread = Thread_Null();
+    return s;
+}
+// capacity events can wait in the queue and in the heap, lookahead in seconds is how far monotonic events get pushed back
+Sequencer Sequencer_New(OAudio* out,size_t capacity,double lookahead){
+    Sequencer s = Sequencer_Null();
+    if(out->bits!=16){
+        printf("[Sequencer]: New -> only 16 bit output is supported!\n");
+        return s;
+    }
+
+    size_t size = 2;
+    while(size < capacity) size <<= 1;
+    s.out = out;
+    s.cells = malloc(size * sizeof(SequencerCell));
+    for(size_t i = 0;i<size;i++) atomic_init(&s.cells[i].seq,i);
+    s.mask = size - 1;
+    atomic_init(&s.enqueue,0);
+    s.HEAP_SIZE = size;
+    s.heap = malloc(size * sizeof(SequencerEvent));
+    s.mix = malloc(out->frames * out->numChannels * sizeof(float));
+    s.period = malloc(out->frames * out->bytes_per_frame);
+    atomic_init(&s.position,0);
+    s.lookahead = (unsigned long long)(lookahead * out->rate);
+    s.origin = out->pcm_handle ? out->backend.now(out->pcm_handle) : 0;
+    return s;
+}
+// clock monotonic timestamps are read from: Time_Nano on alsa, the device clock on the memory and sim backends
+Timepoint Sequencer_Clock(Sequencer* s){
+    return s->out->backend.now(s->out->pcm_handle);
+}
+// sample time the audio thread renders next, post at Position + lookahead or later to be on time
+unsigned long long Sequencer_Position(Sequencer* s){
+    return atomic_load_explicit(&s->position,memory_order_acquire);
+}
+// monotonic nanoseconds to sample time, including the look-ahead
+unsigned long long Sequencer_Time(Sequencer* s,Timepoint ns){
+    long long elapsed = (long long)(ns - s->origin);
+    long long rate = s->out->rate;
+    long long nano = TIME_NANOTOSEC;
+    // whole seconds and the rest apart, elapsed * rate alone overflows after about 53 hours at 48 kHz
+    long long frames = elapsed / nano * rate + elapsed % nano * rate / nano + (long long)s->lookahead;
+    return frames > 0 ? (unsigned long long)frames : 0;
+}
+// returns 0 without waiting if the queue is full
+char Sequencer_Post(Sequencer* s,unsigned long long time,WavFile* sound,float gain){
+    size_t pos = atomic_load_explicit(&s->enqueue,memory_order_relaxed);
+    SequencerCell* cell;
+    while(1){
+        cell = s->cells + (pos & s->mask);
+        size_t seq = atomic_load_explicit(&cell->seq,memory_order_acquire);
+        long diff = (long)seq - (long)pos;
+        if(diff==0){
+            if(atomic_compare_exchange_weak_explicit(&s->enqueue,&pos,pos + 1,memory_order_relaxed,memory_order_relaxed)) break;
+        }else if(diff<0){
+            atomic_fetch_add_explicit(&s->rejected,1,memory_order_relaxed);
+            return 0;
+        }else{
+            pos = atomic_load_explicit(&s->enqueue,memory_order_relaxed);
+        }
+    }
+    cell->event.time = time;
+    cell->event.sound = sound;
+    cell->event.gain = gain;
+    cell->event.order = atomic_fetch_add_explicit(&s->posted,1,memory_order_relaxed);
+    atomic_store_explicit(&cell->seq,pos + 1,memory_order_release);
+    return 1;
+}
+// ns from Sequencer_Clock, plays lookahead seconds after that
+char Sequencer_PostAt(Sequencer* s,Timepoint ns,WavFile* sound,float gain){
+    return Sequencer_Post(s,Sequencer_Time(s,ns),sound,gain);
+}
+char Sequencer_Take(Sequencer* s,SequencerEvent* e){
+    SequencerCell* cell = s->cells + (s->dequeue & s->mask);
+    size_t seq = atomic_load_explicit(&cell->seq,memory_order_acquire);
+    if((long)seq - (long)(s->dequeue + 1) < 0) return 0;
+    *e = cell->event;
+    atomic_store_explicit(&cell->seq,s->dequeue + s->mask + 1,memory_order_release);
+    s->dequeue++;
+    return 1;
+}
+char Sequencer_Before(SequencerEvent* a,SequencerEvent* b){
+    return a->time < b->time || (a->time == b->time && a->order < b->order);
+}
+void Sequencer_HeapPush(Sequencer* s,SequencerEvent* e){
+    int i = s->heap_size++;
+    while(i>0){
+        int parent = (i - 1) / 2;
+        if(!Sequencer_Before(e,s->heap + parent)) break;
+        s->heap[i] = s->heap[parent];
+        i = parent;
+    }
+    s->heap[i] = *e;
+}
+SequencerEvent Sequencer_HeapPop(Sequencer* s){
+    SequencerEvent top = s->heap[0];
+    SequencerEvent last = s->heap[--s->heap_size];
+    int i = 0;
+    while(1){
+        int child = 2 * i + 1;
+        if(child >= s->heap_size) break;
+        if(child + 1 < s->heap_size && Sequencer_Before(s->heap + child + 1,s->heap + child)) child++;
+        if(!Sequencer_Before(s->heap + child,&last)) break;
+        s->heap[i] = s->heap[child];
+        i = child;
+    }
+    if(s->heap_size>0) s->heap[i] = last;
+    return top;
+}
+// a full voice table steals the voice that played the longest
+void Sequencer_Voice(Sequencer* s,SequencerEvent* e,size_t offset){
+    if(!e->sound || !e->sound->buffer) return;
+    SequencerVoice* v;
+    if(s->voice_count < SEQUENCER_VOICES){
+        v = s->voices + s->voice_count++;
+    }else{
+        v = s->voices;
+        for(int i = 1;i<s->voice_count;i++)
+            if(s->voices[i].pos > v->pos) v = s->voices + i;
+        s->stolen++;
+    }
+    v->data = (AudioSample*)e->sound->buffer;
+    v->frames = e->sound->dataSize / s->out->bytes_per_frame;
+    v->pos = 0;
+    v->offset = offset;
+    v->gain = e->gain;
+}
+// fills out with the next frames of the timeline, runs on the audio thread or offline
+void Sequencer_Render(Sequencer* s,AudioSample* out,size_t frames){
+    Timepoint start = Time_Nano();
+    int channels = s->out->numChannels;
+    unsigned long long now = atomic_load_explicit(&s->position,memory_order_relaxed);
+    unsigned long long end = now + frames;
+
+    SequencerEvent e;
+    while(s->heap_size < s->HEAP_SIZE && Sequencer_Take(s,&e))
+        Sequencer_HeapPush(s,&e);
+
+    while(s->heap_size>0 && s->heap[0].time < end){
+        e = Sequencer_HeapPop(s);
+        size_t offset = 0;
+        if(e.time < now){
+            s->late++;
+            if(now - e.time > s->max_error) s->max_error = now - e.time;
+        }else{
+            offset = e.time - now;
+        }
+        Sequencer_Voice(s,&e,offset);
+        s->processed++;
+    }
+
+    memset(s->mix,0,frames * channels * sizeof(float));
+    for(int i = 0;i<s->voice_count;i++){
+        SequencerVoice* v = s->voices + i;
+        size_t n = v->frames - v->pos < frames - v->offset ? v->frames - v->pos : frames - v->offset;
+        float* m = s->mix + v->offset * channels;
+        AudioSample* d = v->data + v->pos * channels;
+        for(size_t j = 0;j<n * channels;j++) m[j] += d[j] * v->gain;
+        v->pos += n;
+        v->offset = 0;
+        if(v->pos >= v->frames){
+            *v = s->voices[--s->voice_count];
+            i--;
+        }
+    }
+    for(size_t i = 0;i<frames * channels;i++){
+        float x = s->mix[i];
+        out[i] = x > 32767.0f ? 32767 : (x < -32768.0f ? -32768 : (AudioSample)lrintf(x));
+    }
+
+    atomic_store_explicit(&s->position,end,memory_order_release);
+    s->periods++;
+    s->render_time += Time_Nano() - start;
+}
+void* Sequencer_Execute(Sequencer* s){
+    while(s->running){
+        Sequencer_Render(s,s->period,s->out->frames);
+        if(OAudio_WriteFrames(s->out,(char*)s->period,s->out->frames) < 0) break;
+    }
+    return NULL;
+}
+// the device buffer plus one period has to fit into the look-ahead for monotonic events to be on time
+void Sequencer_Start(Sequencer* s){
+    if(s->running){
+        printf("[Sequencer]: Start -> can't start because its already running!\n");
+        return;
+    }
+    if(!s->out || !s->out->pcm_handle){
+        printf("[Sequencer]: Start -> output is not open!\n");
+        return;
+    }
+    s->origin = Sequencer_Clock(s) - Time_SecToNano((double)Sequencer_Position(s) / s->out->rate);
+    s->running = 1;
+    s->thread = Thread_New(NULL,(void*)Sequencer_Execute,s);
+    Thread_Start(&s->thread);
+}
+void Sequencer_Stop(Sequencer* s){
+    if(!s->running){
+        printf("[Sequencer]: Stop -> can't stop because it already stopped!\n");
+        return;
+    }
+    s->running = 0;
+    Thread_Join(&s->thread,NULL);
+}
+// timing error is in frames relative to the sample time an event was posted for
+void Sequencer_Print(Sequencer* s){
+    double seconds = s->render_time / TIME_FNANOTOSEC;
+    double audio = s->out ? (double)Sequencer_Position(s) / s->out->rate : 0.0;
+    printf("[Sequencer]: %llu posted, %llu rejected, %llu processed, %llu late, %llu stolen\n",
+        (unsigned long long)atomic_load(&s->posted),(unsigned long long)atomic_load(&s->rejected),s->processed,s->late,s->stolen);
+    printf("[Sequencer]: max timing error %llu frames (%.3f ms), %.0f events/s rendered, %.1fx real-time\n",
+        s->max_error,s->out ? 1000.0 * s->max_error / s->out->rate : 0.0,
+        seconds > 0.0 ? s->processed / seconds : 0.0,seconds > 0.0 ? audio / seconds : 0.0);
+}
+void Sequencer_Free(Sequencer* s){
+    if(s->running) Sequencer_Stop(s);
+    if(s->cells) free(s->cells);
+    if(s->heap) free(s->heap);
+    if(s->mix) free(s->mix);
+    if(s->period) free(s->period);
+    *s = Sequencer_Null();
+}
+
+#endif//!SEQUENCER_H
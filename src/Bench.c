@@ -0,0 +1,261 @@
+#include "../inc/Audio.h"
+#include "../inc/Loudness.h"
+#include "../inc/Convolver.h"
+#include "../inc/Sequencer.h"
+#include "../inc/AudioPool.h"
+
+#include <limits.h>
+#include <sched.h>
+
+#define BENCH_RATE          48000
+#define BENCH_CHANNELS      2
+
+unsigned int Bench_Seed = 0x2545F491;
+
+// runs everything without arguments, otherwise only the named benchmarks: Bench loudness ...
+char Bench_Selected(int argc,char** argv,char* Name){
+    if(argc<2) return 1;
+    for(int i = 1;i<argc;i++)
+        if(strcmp(argv[i],Name)==0) return 1;
+    return 0;
+}
+float Bench_Noise(){
+    Bench_Seed ^= Bench_Seed << 13;
+    Bench_Seed ^= Bench_Seed >> 17;
+    Bench_Seed ^= Bench_Seed << 5;
+    return (Bench_Seed & 0xFFFFFF) / (float)0x800000 - 1.0f;
+}
+// tone plus noise at around -20 dBFS, the same every run
+AudioSample* Bench_Signal(size_t frames,int channels){
+    AudioSample* data = malloc(frames * channels * sizeof(AudioSample));
+    for(size_t f = 0;f<frames;f++)
+        for(int c = 0;c<channels;c++)
+            data[f * channels + c] = (AudioSample)(3000.0f * sinf(f * 0.0573f * (c + 1)) + 1000.0f * Bench_Noise());
+    return data;
+}
+
+// hours of audio measured per second of wall time, on one core and on all of them
+void Bench_Loudness(){
+    double minutes = 10.0;
+    size_t frames = (size_t)(minutes * 60.0 * BENCH_RATE);
+    int frame_size = BENCH_CHANNELS * sizeof(AudioSample);
+    WavFile wf = WavFile_Move(BENCH_RATE,16,BENCH_CHANNELS,(char*)Bench_Signal(frames,BENCH_CHANNELS),frames,frame_size);
+
+    int cores = sysconf(_SC_NPROCESSORS_ONLN);
+    int threads[2] = { 1,cores > 1 ? cores : 1 };
+    for(int i = 0;i<(cores > 1 ? 2 : 1);i++){
+        double best = 0.0;
+        Loudness l;
+        for(int run = 0;run<3;run++){
+            l = Loudness_Measure(&wf,threads[i]);
+            if(best==0.0 || l.elapsed < best) best = l.elapsed;
+        }
+        printf("[Bench]: Loudness %2d threads: %.1f min in %.3f s -> %.2f h of audio per s (%.2f LUFS)\n",
+            threads[i],minutes,best,l.duration / 3600.0 / best,l.integrated);
+    }
+    WavFile_Free(&wf);
+}
+// time per block for growing impulse responses, cost grows linearly with the IR so the period budget gives the length that still runs in real-time
+void Bench_Convolver(){
+    int block = 1024;
+    double budget = (double)block / BENCH_RATE;
+    double lengths[] = { 1.0,2.0,5.0,10.0,20.0 };
+    int cores = sysconf(_SC_NPROCESSORS_ONLN);
+    float* in = malloc(block * sizeof(float));
+    float* out = malloc(block * sizeof(float));
+    for(int i = 0;i<block;i++) in[i] = Bench_Noise() * 0.1f;
+
+    for(int t = 0;t<(cores > 1 ? 2 : 1);t++){
+        int threads = t==0 ? 0 : cores - 1;
+        double supported = 0.0;
+        for(int l = 0;l<(int)(sizeof(lengths) / sizeof(lengths[0]));l++){
+            int length = (int)(lengths[l] * BENCH_RATE);
+            float* ir = malloc(length * sizeof(float));
+            for(int i = 0;i<length;i++) ir[i] = Bench_Noise() * expf(-6.9f * i / length);
+
+            Convolver c = Convolver_New(ir,length,block,threads);
+            Convolver_Start(&c);
+            for(int i = 0;i<16;i++) Convolver_Process(&c,in,out);
+
+            int blocks = 0;
+            Timepoint start = Time_Nano();
+            while(blocks < 64 || Time_Elapsed(start,Time_Nano()) < 0.5){
+                Convolver_Process(&c,in,out);
+                blocks++;
+            }
+            double per_block = Time_Elapsed(start,Time_Nano()) / blocks;
+            supported = lengths[l] * budget / per_block;
+            printf("[Bench]: Convolver %d workers, %4.1f s IR, block %d: %.3f ms per block, %5.1f%% of real-time\n",
+                threads,lengths[l],block,per_block * 1000.0,100.0 * per_block / budget);
+
+            Convolver_Free(&c);
+            free(ir);
+        }
+        printf("[Bench]: Convolver %d workers: about %.0f s of IR in real-time at %d Hz (linear from the longest IR)\n",threads,supported,BENCH_RATE);
+    }
+    free(in);
+    free(out);
+}
+#define BENCH_SPACING       16          // frames between offline events, a 64 frame click keeps about 4 voices busy
+#define BENCH_WINDOW        16384       // offline producers stay this many frames ahead of the render position
+
+typedef struct BenchProducer{
+    Sequencer* s;
+    WavFile* sound;
+    int id;
+    int producers;
+    int events;
+    char realtime;
+    _Atomic unsigned long long reached;     // sample time of the last offline post
+} BenchProducer;
+
+// offline: every producer owns every producers-th slot of a fixed timeline, realtime: one event every 500us on the output clock
+void* Bench_Produce(BenchProducer* p){
+    for(int i = 0;i<p->events;i++){
+        if(p->realtime){
+            Sequencer_PostAt(p->s,Sequencer_Clock(p->s),p->sound,0.1f);
+            Thread_Sleep_N(500000ULL);
+            continue;
+        }
+        unsigned long long time = ((unsigned long long)i * p->producers + p->id + 1) * BENCH_SPACING;
+        while(time >= Sequencer_Position(p->s) + BENCH_WINDOW) sched_yield();
+        while(!Sequencer_Post(p->s,time,p->sound,0.1f)) sched_yield();
+        atomic_store(&p->reached,time);
+    }
+    atomic_store(&p->reached,ULLONG_MAX);
+    return NULL;
+}
+void Bench_SequencerRun(OAudio* out,WavFile* click,int producers,int events,double lookahead,char realtime){
+    Sequencer s = Sequencer_New(out,65536,lookahead);
+    BenchProducer p[producers];
+    Thread threads[producers];
+    AudioSample* period = malloc(out->frames * out->bytes_per_frame);
+
+    Timepoint start = Time_Nano();
+    if(realtime) Sequencer_Start(&s);
+    for(int i = 0;i<producers;i++){
+        p[i] = (BenchProducer){ &s,click,i,producers,events / producers,realtime };
+        atomic_init(&p[i].reached,0);
+        threads[i] = Thread_New(NULL,(void*)Bench_Produce,p + i);
+        Thread_Start(threads + i);
+    }
+    if(realtime){
+        for(int i = 0;i<producers;i++) Thread_Join(threads + i,NULL);
+        Thread_Sleep_N(100000000ULL);
+        Sequencer_Stop(&s);
+    }else{
+        // the bench thread is the audio thread, it only renders a period once every producer posted past its end
+        unsigned long long total = (unsigned long long)(events / producers) * producers;
+        while(s.processed < total){
+            unsigned long long reached = ULLONG_MAX;
+            for(int i = 0;i<producers;i++){
+                unsigned long long r = atomic_load(&p[i].reached);
+                if(r < reached) reached = r;
+            }
+            if(reached < Sequencer_Position(&s) + out->frames){
+                sched_yield();
+                continue;
+            }
+            Sequencer_Render(&s,period,out->frames);
+        }
+        for(int i = 0;i<producers;i++) Thread_Join(threads + i,NULL);
+    }
+    double elapsed = Time_Elapsed(start,Time_Nano());
+    double rendering = s.render_time / TIME_FNANOTOSEC;
+
+    printf("[Bench]: Sequencer %s, %d producers: %llu events in %.3f s -> %.0f events/s posted and rendered, %.0f events/s in render\n",
+        realtime ? "real-time" : "offline",producers,s.processed,elapsed,s.processed / elapsed,rendering > 0.0 ? s.processed / rendering : 0.0);
+    printf("[Bench]: Sequencer %s, %d producers: %llu late, max error %llu frames (%.3f ms), %llu stolen, %llu rejected\n",
+        realtime ? "real-time" : "offline",producers,s.late,s.max_error,1000.0 * s.max_error / out->rate,s.stolen,(unsigned long long)atomic_load(&s.rejected));
+    free(period);
+    Sequencer_Free(&s);
+}
+// events/s the sequencer sustains offline, and how late events posted on the output clock start on a real device
+void Bench_Sequencer(){
+    int frames = 64;
+    WavFile click = WavFile_Move(BENCH_RATE,16,BENCH_CHANNELS,(char*)Bench_Signal(frames,BENCH_CHANNELS),frames,BENCH_CHANNELS * sizeof(AudioSample));
+
+    AudioMemory m = AudioMemory_New();
+    OAudio out = OAudio_NewOn(AudioBackend_Memory(&m),SND_PCM_FORMAT_S16_LE,16,256,BENCH_CHANNELS,BENCH_RATE);
+    Bench_SequencerRun(&out,&click,1,2000000,0.0,0);
+    Bench_SequencerRun(&out,&click,4,2000000,0.0,0);
+    OAudio_Free(&out);
+    AudioMemory_Free(&m);
+
+    out = OAudio_New(SND_PCM_FORMAT_S16_LE,16,256,BENCH_CHANNELS,BENCH_RATE);
+    if(out.pcm_handle){
+        // the alsa backend asks for a buffer of frames * bytes_per_frame frames, that plus one period and some margin
+        double lookahead = (double)(out.frames * out.bytes_per_frame + out.frames) / out.rate + 0.005;
+        Bench_SequencerRun(&out,&click,4,4000,lookahead,1);
+        OAudio_Free(&out);
+    }else{
+        printf("[Bench]: Sequencer real-time -> no alsa device, skipped\n");
+    }
+    WavFile_Free(&click);
+}
+#define BENCH_PERIOD        256
+
+// seconds from opening the output until its first period was handed to the device, -1 if it didn't open
+double Bench_PoolFirst(AudioBackend backend,char* period){
+    Timepoint start = Time_Nano();
+    OAudio out = OAudio_NewOn(backend,SND_PCM_FORMAT_S16_LE,16,BENCH_PERIOD,BENCH_CHANNELS,BENCH_RATE);
+    if(!out.pcm_handle) return -1.0;
+    OAudio_WriteFrames(&out,period,BENCH_PERIOD);
+    double first = Time_Elapsed(start,Time_Nano());
+    OAudio_Free(&out);
+    return first;
+}
+// cold opens straight on the backend against opens through a pool over it, interleaved so both see the same load
+void Bench_PoolRun(char* Name,AudioBackend backend,int runs,char* period){
+    AudioPool pool = AudioPool_New(backend);
+    AudioPool_Start(&pool);
+    // the first open through the pool is cold as well, afterwards its handle stays prepared
+    Bench_PoolFirst(AudioPool_Backend(&pool),period);
+
+    const char* Kind[2] = { "cold","warm" };
+    double sum[2] = { 0.0,0.0 };
+    double max[2] = { 0.0,0.0 };
+    for(int i = 0;i<runs;i++){
+        for(int k = 0;k<2;k++){
+            double first = Bench_PoolFirst(k==0 ? backend : AudioPool_Backend(&pool),period);
+            if(first < 0.0){
+                printf("[Bench]: Pool %s -> %s open failed!\n",Name,Kind[k]);
+                AudioPool_Free(&pool);
+                return;
+            }
+            sum[k] += first;
+            if(first > max[k]) max[k] = first;
+        }
+    }
+    double budget = (double)BENCH_PERIOD / BENCH_RATE;
+    for(int k = 0;k<2;k++)
+        printf("[Bench]: Pool %s %s: open-to-first-writei %.1f us avg, %.1f us max over %d opens, %.1f%% of one %d frame period (%.3f ms)\n",
+            Name,Kind[k],1.0E6 * sum[k] / runs,1.0E6 * max[k],runs,100.0 * sum[k] / runs / budget,BENCH_PERIOD,1000.0 * budget);
+    AudioPool_Print(&pool);
+    AudioPool_Free(&pool);
+}
+// what the pool saves on the way from open to the first sample, on the memory backend and on the default alsa device
+void Bench_Pool(){
+    char* period = calloc(BENCH_PERIOD,BENCH_CHANNELS * sizeof(AudioSample));
+
+    AudioMemory m = AudioMemory_New();
+    Bench_PoolRun("memory",AudioBackend_Memory(&m),10000,period);
+    AudioMemory_Free(&m);
+
+    OAudio probe = OAudio_New(SND_PCM_FORMAT_S16_LE,16,BENCH_PERIOD,BENCH_CHANNELS,BENCH_RATE);
+    if(probe.pcm_handle){
+        OAudio_Free(&probe);
+        Bench_PoolRun("alsa",AudioBackend_Alsa(),50,period);
+    }else{
+        printf("[Bench]: Pool alsa -> no alsa device, skipped\n");
+    }
+    free(period);
+}
+
+int main(int argc,char** argv){
+    if(Bench_Selected(argc,argv,"loudness")) Bench_Loudness();
+    if(Bench_Selected(argc,argv,"convolver")) Bench_Convolver();
+    if(Bench_Selected(argc,argv,"sequencer")) Bench_Sequencer();
+    if(Bench_Selected(argc,argv,"pool")) Bench_Pool();
+    return 0;
+}
@@ -1,4 +1,5 @@
 #include "../inc/Audio.h"
+#include "../inc/AudioQueue.h"
 
 #define SAMPLE_RATE         44100
 #define CHANNELS            1
@@ -26,17 +27,19 @@
 
 
 int main(int argc, char *argv[]) {
-    if (argc != 2) {
-        printf("use: %s <wav-file .wav>\n",argv[0]);
+    if (argc < 2) {
+        printf("use: %s <wav-file .wav> ...\n",argv[0]);
         return 1;
     }
 
     OAudio a = OAudio_New(FORMAT,BITS_PER_SAMPLE,FRAMES_PER_BUFFER,2,SAMPLE_RATE);
-    WavFile wf = WavFile_Read(argv[1],FRAMES_PER_BUFFER);
+    AudioQueue q = AudioQueue_New(&a);
 
-    OAudio_Play(&a,&wf);
+    for(int i = 1;i<argc;i++)
+        AudioQueue_Push(&q,argv[i]);
+    AudioQueue_Play(&q);
 
-    WavFile_Free(&wf);
+    AudioQueue_Free(&q);
     OAudio_Free(&a);
 
     printf("replay done.\n");
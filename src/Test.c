@@ -0,0 +1,372 @@
+#include "../inc/Audio.h"
+#include "../inc/AudioQueue.h"
+#include "../inc/Loudness.h"
+#include "../inc/AudioAggregate.h"
+#include "../inc/AudioPreroll.h"
+
+#define TEST_RATE           48000
+#define TEST_CHANNELS       2
+#define TEST_PERIOD         512
+
+int Test_Failed = 0;
+
+void Test_Check(char ok,char* Name){
+    printf("[Test]: %s -> %s\n",Name,ok ? "ok" : "failed!");
+    if(!ok) Test_Failed++;
+}
+// 16 bit stereo ramp that never repeats within a file, so a dropped or doubled frame shows up in the compare
+AudioSample* Test_Signal(int frames,int seed){
+    AudioSample* data = malloc(frames * TEST_CHANNELS * sizeof(AudioSample));
+    for(int i = 0;i<frames * TEST_CHANNELS;i++) data[i] = (AudioSample)(i * 7 + seed);
+    return data;
+}
+void Test_WriteWav(char* Path,AudioSample* data,int frames){
+    WavFile wf = WavFile_Move(TEST_RATE,16,TEST_CHANNELS,(char*)data,frames,TEST_CHANNELS * sizeof(AudioSample));
+    WavFile_Write(&wf,Path);
+}
+
+// two files with lengths that are no multiple of the period have to come out back to back without a gap
+void Test_QueueGapless(){
+    int frames_a = 10007;
+    int frames_b = 5003;
+    int frame_size = TEST_CHANNELS * sizeof(AudioSample);
+    AudioSample* a = Test_Signal(frames_a,1);
+    AudioSample* b = Test_Signal(frames_b,3);
+    Test_WriteWav("./build/test_a.wav",a,frames_a);
+    Test_WriteWav("./build/test_b.wav",b,frames_b);
+
+    AudioMemory m = AudioMemory_New();
+    OAudio out = OAudio_NewOn(AudioBackend_Memory(&m),SND_PCM_FORMAT_S16_LE,16,TEST_PERIOD,TEST_CHANNELS,TEST_RATE);
+    AudioQueue q = AudioQueue_New(&out);
+    AudioQueue_Push(&q,"./build/test_a.wav");
+    AudioQueue_Push(&q,"./build/test_b.wav");
+    AudioQueue_Play(&q);
+    AudioQueue_Free(&q);
+
+    char ok = m.sink.size == (frames_a + frames_b) * frame_size;
+    ok = ok && memcmp(m.sink.Memory,a,frames_a * frame_size)==0;
+    ok = ok && memcmp((char*)m.sink.Memory + frames_a * frame_size,b,frames_b * frame_size)==0;
+    Test_Check(ok,"AudioQueue gapless");
+
+    OAudio_Free(&out);
+    AudioMemory_Free(&m);
+    free(a);
+    free(b);
+}
+// a 32 bit float file queued before a 16 bit one has to decode to the same samples it was made from
+void Test_QueueFloat(){
+    int frames_a = 7001;
+    int frames_b = 3001;
+    int frame_size = TEST_CHANNELS * sizeof(AudioSample);
+    AudioSample* a = Test_Signal(frames_a,5);
+    AudioSample* b = Test_Signal(frames_b,7);
+    float* fa = malloc(frames_a * TEST_CHANNELS * sizeof(float));
+    for(int i = 0;i<frames_a * TEST_CHANNELS;i++) fa[i] = a[i] / 32768.0f;
+
+    WavFile wf = WavFile_Move(TEST_RATE,32,TEST_CHANNELS,(char*)fa,frames_a,TEST_CHANNELS * sizeof(float));
+    wf.fmtChunk.audioFormat = 3;
+    WavFile_Write(&wf,"./build/test_float.wav");
+    WavFile_Free(&wf);
+    Test_WriteWav("./build/test_b.wav",b,frames_b);
+
+    AudioMemory m = AudioMemory_New();
+    OAudio out = OAudio_NewOn(AudioBackend_Memory(&m),SND_PCM_FORMAT_S16_LE,16,TEST_PERIOD,TEST_CHANNELS,TEST_RATE);
+    AudioQueue q = AudioQueue_New(&out);
+    AudioQueue_Push(&q,"./build/test_float.wav");
+    AudioQueue_Push(&q,"./build/test_b.wav");
+    AudioQueue_Play(&q);
+    AudioQueue_Free(&q);
+
+    char ok = m.sink.size == (frames_a + frames_b) * frame_size;
+    ok = ok && memcmp(m.sink.Memory,a,frames_a * frame_size)==0;
+    ok = ok && memcmp((char*)m.sink.Memory + frames_a * frame_size,b,frames_b * frame_size)==0;
+    Test_Check(ok,"AudioQueue float wav");
+
+    OAudio_Free(&out);
+    AudioMemory_Free(&m);
+    free(a);
+    free(b);
+}
+// 1s silence, 0.5s tone, 1s silence: one segment that opens one pre-roll before the tone
+void Test_VadSegments(){
+    int frames = TEST_RATE * 5 / 2;
+    AudioSample* data = calloc(frames * TEST_CHANNELS,sizeof(AudioSample));
+    for(int i = TEST_RATE;i<TEST_RATE * 3 / 2;i++)
+        for(int c = 0;c<TEST_CHANNELS;c++) data[i * TEST_CHANNELS + c] = (AudioSample)(8000.0 * sin(i * 0.1));
+
+    AudioMemory m = AudioMemory_New();
+    AudioMemory_Source(&m,(char*)data,frames * TEST_CHANNELS * sizeof(AudioSample),0);
+    IAudio in = IAudio_NewOn(AudioBackend_Memory(&m),SND_PCM_FORMAT_S16_LE,16,TEST_PERIOD,TEST_CHANNELS,TEST_RATE,0);
+    IAudio_Gate(&in,-30.0f,100,100);
+    in.running = 1;
+    IAudio_Execute(&in);
+    in.running = 0;
+
+    char ok = AudioVad_Count(&in.vad)==1;
+    if(ok){
+        AudioVadSegment* s = (AudioVadSegment*)in.vad.segments.Memory;
+        double start = Time_NanoToSec(s->start);
+        double end = Time_NanoToSec(s->end);
+        ok = start > 0.85 && start <= 1.0 && end >= 1.5 && end < 1.7;
+    }
+    Test_Check(ok,"AudioVad segment times");
+
+    IAudio_Free(&in);
+    AudioMemory_Free(&m);
+    free(data);
+}
+// three bursts in silence: two clips that start one pre-roll before the end of the triggering period,
+// the third burst comes while both clips still wait for the writer and has to count as missed
+void Test_Preroll(){
+    int frames = TEST_RATE * 3;
+    int frame_size = TEST_CHANNELS * sizeof(AudioSample);
+    int pre = TEST_RATE / 10;
+    int post = TEST_RATE / 5;
+    int bursts[3] = { 100 * TEST_PERIOD,200 * TEST_PERIOD,250 * TEST_PERIOD };
+    AudioSample* data = calloc(frames * TEST_CHANNELS,sizeof(AudioSample));
+    for(int b = 0;b<3;b++)
+        for(int i = bursts[b];i<bursts[b] + TEST_PERIOD / 2;i++)
+            for(int c = 0;c<TEST_CHANNELS;c++) data[i * TEST_CHANNELS + c] = 20000;
+
+    AudioMemory m = AudioMemory_New();
+    AudioMemory_Source(&m,(char*)data,frames * frame_size,0);
+    AudioPreroll p = AudioPreroll_NewOn(AudioBackend_Memory(&m),SND_PCM_FORMAT_S16_LE,16,TEST_PERIOD,TEST_CHANNELS,TEST_RATE,0,
+        (double)pre / TEST_RATE,(double)post / TEST_RATE,"./build/test_preroll");
+    AudioPreroll_Level(&p,-6.0f);
+
+    // capture and writer run one after the other, so the writer can't free a clip before the third burst
+    pthread_mutex_init(&p.mutex,NULL);
+    pthread_cond_init(&p.cond,NULL);
+    p.running = 1;
+    AudioPreroll_Execute(&p);
+    p.running = 0;
+    AudioPreroll_Writer(&p);
+    pthread_mutex_destroy(&p.mutex);
+    pthread_cond_destroy(&p.cond);
+
+    char ok = p.count==2 && p.missed==1;
+    char* Paths[2] = { "./build/test_preroll_000.wav","./build/test_preroll_001.wav" };
+    for(int i = 0;i<2 && ok;i++){
+        WavFile wf = WavFile_Read(Paths[i],1);
+        int start = bursts[i] + TEST_PERIOD - pre;
+        ok = wf.buffer && (int)wf.dataSize==(pre + post) * frame_size;
+        ok = ok && memcmp(wf.buffer,data + start * TEST_CHANNELS,wf.dataSize)==0;
+        ok = ok && ((AudioSample*)wf.buffer)[(pre - TEST_PERIOD) * TEST_CHANNELS]==20000;
+        WavFile_Free(&wf);
+    }
+    Test_Check(ok,"AudioPreroll clips and missed triggers");
+
+    AudioPreroll_Free(&p);
+    AudioMemory_Free(&m);
+    free(data);
+}
+// capture publishes one period per round: reader a keeps up and gets every frame,
+// reader b reads once early and then falls behind by more than capacity - period, so it loses the lapped frames
+void Test_BusReaders(){
+    int periods = 16;
+    int frames = periods * TEST_PERIOD;
+    int frame_size = TEST_CHANNELS * sizeof(AudioSample);
+    AudioSample* data = Test_Signal(frames,15);
+    AudioSample* seen[2] = { malloc(frames * frame_size),malloc(frames * frame_size) };
+
+    AudioMemory m = AudioMemory_New();
+    IAudio in = IAudio_NewOn(AudioBackend_Memory(&m),SND_PCM_FORMAT_S16_LE,16,TEST_PERIOD,TEST_CHANNELS,TEST_RATE,0);
+    IAudio_Publish(&in,"cmd_audio_test",8);
+    AudioBusReader r[2] = { AudioBusReader_New("cmd_audio_test"),AudioBusReader_New("cmd_audio_test") };
+    unsigned int got[2] = { 0,0 };
+
+    for(int i = 0;i<periods;i++){
+        AudioMemory_Source(&m,(char*)(data + i * TEST_PERIOD * TEST_CHANNELS),TEST_PERIOD * frame_size,0);
+        in.running = 1;
+        IAudio_Execute(&in);
+        in.running = 0;
+        got[0] += AudioBusReader_Read(r,(char*)seen[0] + got[0] * frame_size,frames - got[0]);
+        if(i==3) got[1] += AudioBusReader_Read(r + 1,(char*)seen[1],frames);
+    }
+    unsigned int early = got[1];
+    got[1] += AudioBusReader_Read(r + 1,(char*)seen[1] + early * frame_size,frames - early);
+
+    unsigned int lapped = frames - (r[1].header->capacity - r[1].header->period);
+    char ok = got[0]==(unsigned int)frames && memcmp(seen[0],data,frames * frame_size)==0 && r[0].overruns==0 && r[0].lost==0;
+    ok = ok && early==4 * TEST_PERIOD && memcmp(seen[1],data,early * frame_size)==0;
+    ok = ok && r[1].overruns==1 && r[1].lost==lapped - early && got[1]==early + frames - lapped;
+    ok = ok && memcmp((char*)seen[1] + early * frame_size,(char*)seen[0] + lapped * frame_size,(frames - lapped) * frame_size)==0;
+    Test_Check(ok,"AudioBus readers see the same frames and count overruns");
+
+    AudioBusReader_Free(r);
+    AudioBusReader_Free(r + 1);
+    IAudio_Free(&in);
+    AudioMemory_Free(&m);
+    free(seen[0]);
+    free(seen[1]);
+    free(data);
+}
+// 24 bit stereo WAVE_FORMAT_EXTENSIBLE gets normalized and written back as a valid plain pcm file
+void Test_LoudnessExtensible(){
+    char* Path = "./build/test_ext.wav";
+    int frames = TEST_RATE * 3;
+    uint32_t data_size = frames * TEST_CHANNELS * 3;
+    unsigned char* data = malloc(data_size);
+    for(int i = 0;i<frames * TEST_CHANNELS;i++){
+        int32_t v = (int32_t)(0.1 * 8388607.0 * sin((i / TEST_CHANNELS) * 2.0 * M_PI * 1000.0 / TEST_RATE));
+        for(int b = 0;b<3;b++) data[i * 3 + b] = (v >> (b * 8)) & 0xFF;
+    }
+
+    unsigned char guid[16] = { 0x01,0x00,0x00,0x00,0x00,0x00,0x10,0x00,0x80,0x00,0x00,0xAA,0x00,0x38,0x9B,0x71 };
+    uint32_t riff_size = 4 + 8 + 40 + 8 + data_size;
+    uint32_t fmt_size = 40;
+    uint16_t fmt[] = { 0xFFFE,TEST_CHANNELS };
+    uint32_t rates[] = { TEST_RATE,TEST_RATE * TEST_CHANNELS * 3 };
+    uint16_t align[] = { TEST_CHANNELS * 3,24,22,24 };
+    uint32_t mask = 3;
+
+    FILE* file = fopen(Path,"wb");
+    fwrite("RIFF",1,4,file);
+    fwrite(&riff_size,4,1,file);
+    fwrite("WAVEfmt ",1,8,file);
+    fwrite(&fmt_size,4,1,file);
+    fwrite(fmt,2,2,file);
+    fwrite(rates,4,2,file);
+    fwrite(align,2,4,file);
+    fwrite(&mask,4,1,file);
+    fwrite(guid,1,16,file);
+    fwrite("data",1,4,file);
+    fwrite(&data_size,4,1,file);
+    fwrite(data,1,data_size,file);
+    fclose(file);
+    free(data);
+
+    Loudness_NormalizeFile(Path,-16.0,-1.0,2);
+
+    WavFile wf = WavFile_Read(Path,1);
+    Loudness l = Loudness_Measure(&wf,2);
+    char ok = wf.buffer && wf.fmtChunk.audioFormat==1 && wf.fmtChunk.bitsPerSample==24 && fabs(l.integrated + 16.0) < 0.1;
+    Test_Check(ok,"Loudness extensible wav");
+    WavFile_Free(&wf);
+}
+// two memory devices capture faster than the merge stage consumes, so both drop periods: output has to keep growing
+void Test_AggregateDrops(){
+    int frames = TEST_RATE;
+    AudioSample* data = Test_Signal(frames,5);
+    AudioMemory m[2] = { AudioMemory_New(),AudioMemory_New() };
+    AudioBackend backends[2];
+    for(int i = 0;i<2;i++){
+        AudioMemory_Source(m + i,(char*)data,frames * TEST_CHANNELS * sizeof(AudioSample),1);
+        backends[i] = AudioBackend_Memory(m + i);
+    }
+    char* Names[2] = { "a","b" };
+    AudioAggregate a = AudioAggregate_NewOn(backends,Names,2,SND_PCM_FORMAT_S16_LE,16,256,TEST_CHANNELS,TEST_RATE,0);
+    AudioAggregate_Start(&a);
+
+    Timepoint start = Time_Nano();
+    while((a.devices[0].dropped==0 || a.devices[1].dropped==0) && Time_Elapsed(start,Time_Nano()) < 2.0) Thread_Sleep_N(1000000ULL);
+    Thread_Sleep_N(100000000ULL);
+    int before = a.buffer.size;
+    Thread_Sleep_N(100000000ULL);
+    int after = a.buffer.size;
+    AudioAggregate_Stop(&a);
+
+    Test_Check(a.devices[0].dropped>0 && after > before,"AudioAggregate keeps merging after drops");
+
+    AudioAggregate_Free(&a);
+    AudioMemory_Free(m);
+    AudioMemory_Free(m + 1);
+    free(data);
+}
+// xruns and short reads on the sim backend: capture recovers and still gets every source frame exactly once
+void Test_SimCapture(){
+    int frames = TEST_RATE;
+    int size = frames * TEST_CHANNELS * sizeof(AudioSample);
+    AudioSample* data = Test_Signal(frames,9);
+    AudioMemory m = AudioMemory_New();
+    AudioMemory_Source(&m,(char*)data,size,0);
+    AudioMemory_Faults(&m,0.05,0.001,0.2,7);
+
+    IAudio in = IAudio_NewOn(AudioBackend_Sim(&m),SND_PCM_FORMAT_S16_LE,16,TEST_PERIOD,TEST_CHANNELS,TEST_RATE,0);
+    in.running = 1;
+    IAudio_Execute(&in);
+    in.running = 0;
+
+    char ok = m.xruns > 0 && in.buffer.size==size && memcmp(in.buffer.Memory,data,size)==0;
+    Test_Check(ok,"Sim capture recovers from xruns");
+
+    IAudio_Free(&in);
+    AudioMemory_Free(&m);
+    free(data);
+}
+// the aggregate stamps periods with the device clock, so its rate estimate holds even though capture runs faster than real-time
+void Test_SimClock(){
+    int frames = TEST_RATE;
+    AudioSample* data = Test_Signal(frames,11);
+    AudioMemory m[2] = { AudioMemory_New(),AudioMemory_New() };
+    AudioBackend backends[2];
+    for(int i = 0;i<2;i++){
+        AudioMemory_Source(m + i,(char*)data,frames * TEST_CHANNELS * sizeof(AudioSample),1);
+        AudioMemory_Faults(m + i,0.0,0.0005,0.0,3 + i);
+        backends[i] = AudioBackend_Sim(m + i);
+    }
+    char* Names[2] = { "a","b" };
+    AudioAggregate a = AudioAggregate_NewOn(backends,Names,2,SND_PCM_FORMAT_S16_LE,16,TEST_PERIOD,TEST_CHANNELS,TEST_RATE,0);
+    AudioAggregate_Start(&a);
+    Thread_Sleep_N(200000000ULL);
+    AudioAggregate_Stop(&a);
+
+    char ok = 1;
+    for(int i = 0;i<2;i++){
+        double rate = AudioAggregate_Rate(&a,a.devices + i);
+        ok = ok && fabs(rate - TEST_RATE) < TEST_RATE * 0.001;
+    }
+    Test_Check(ok,"Sim clock drives the aggregate rate estimate");
+
+    AudioAggregate_Free(&a);
+    AudioMemory_Free(m);
+    AudioMemory_Free(m + 1);
+    free(data);
+}
+// device b starts its clock 100 ms after device a: both have to come out sample aligned on b's first frame
+void Test_AggregateAlign(){
+    int frames = TEST_RATE;
+    int shift = TEST_RATE / 10;
+    AudioSample* data = Test_Signal(frames,13);
+    AudioMemory m[2] = { AudioMemory_New(),AudioMemory_New() };
+    AudioBackend backends[2];
+    for(int i = 0;i<2;i++){
+        AudioMemory_Source(m + i,(char*)data,frames * TEST_CHANNELS * sizeof(AudioSample),1);
+        backends[i] = AudioBackend_Memory(m + i);
+    }
+    m[1].offset = 100000000LL;
+    char* Names[2] = { "a","b" };
+    AudioAggregate a = AudioAggregate_NewOn(backends,Names,2,SND_PCM_FORMAT_S16_LE,16,TEST_PERIOD,TEST_CHANNELS,TEST_RATE,0);
+    AudioAggregate_Start(&a);
+    Timepoint start = Time_Nano();
+    while(a.buffer.size < TEST_PERIOD * 2 * TEST_CHANNELS * (int)sizeof(AudioSample) && Time_Elapsed(start,Time_Nano()) < 2.0) Thread_Sleep_N(1000000ULL);
+    AudioAggregate_Stop(&a);
+
+    AudioSample* out = (AudioSample*)a.buffer.Memory;
+    char ok = a.buffer.size >= TEST_PERIOD * 2 * TEST_CHANNELS * (int)sizeof(AudioSample);
+    for(int f = 0;ok && f<TEST_PERIOD;f++)
+        for(int c = 0;c<TEST_CHANNELS;c++)
+            ok = ok && out[f * 2 * TEST_CHANNELS + c]==data[(f + shift) * TEST_CHANNELS + c] && out[(f * 2 + 1) * TEST_CHANNELS + c]==data[f * TEST_CHANNELS + c];
+    Test_Check(ok,"AudioAggregate aligns a late starting device");
+
+    AudioAggregate_Free(&a);
+    AudioMemory_Free(m);
+    AudioMemory_Free(m + 1);
+    free(data);
+}
+
+int main(){
+    Test_QueueGapless();
+    Test_QueueFloat();
+    Test_VadSegments();
+    Test_Preroll();
+    Test_BusReaders();
+    Test_LoudnessExtensible();
+    Test_AggregateDrops();
+    Test_SimCapture();
+    Test_SimClock();
+    Test_AggregateAlign();
+
+    printf("[Test]: %d failed\n",Test_Failed);
+    return Test_Failed>0;
+}